@@ -2,12 +2,15 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
 struct pipe;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vma;
+struct shm;
 
 // bio.c
 void            binit(void);
@@ -23,7 +26,7 @@ void            consoleintr(int);
 void            consputc(int);
 
 // exec.c
-int             exec(char*, char**);
+int             exec(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -62,7 +65,26 @@ void            ramdiskrw(struct buf*);
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
+void            kfree_batch(void **, int);
 void            kinit(void);
+void*           kalloc_zeroed(void);
+void            kzero_refill(void);
+void            krefinc(void *);
+int             krefcnt(void *);
+void*           kalloc_order(int);
+void            kfree_order(void *, int);
+void*           kalloc_pages(int);
+extern uint64   phystop;
+
+// fdt.c
+uint64          fdtphystop(void);
+
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void*           kmem_cache_alloc(struct kmem_cache*);
+void            kmem_cache_free(struct kmem_cache*, void*);
+int             kmem_cache_reap(void);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -71,6 +93,7 @@ void            begin_op(void);
 void            end_op(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
@@ -85,8 +108,8 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             spawn(char*, char**, struct file**);
 int             growproc(int);
-void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
@@ -97,17 +120,31 @@ void            procinit(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
+int             sleeptimed(void*, struct spinlock*, uint);
+void            timertick(uint);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
 void            yield(void);
+void            runqboost(void);
+int             schedtick(void);
+int             nice(int);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+struct proc*    procsweep(int*, int);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// shm.c
+void            shminit(void);
+int             shmcreate(int);
+uint64          shmattach(int);
+int             shmdetach(uint64);
+void            shmdup(struct shm*);
+void            shmput(struct shm*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
@@ -115,6 +152,11 @@ void            initlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+int             cansleep(void);
+#ifdef LAB_LOCK
+void            freelock(struct spinlock*);
+int             statslock(char*, int);
+#endif
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
@@ -122,6 +164,12 @@ void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
+// sprintf.c
+int             snprintf(char*, int, char*, ...);
+
+// stats.c
+void            statsinit(void);
+
 // string.c
 int             memcmp(const void*, const void*, uint);
 void*           memmove(void*, const void*, uint);
@@ -156,20 +204,62 @@ int             uartgetc(void);
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+pagetable_t     kvmcreate(void);
+void            kvmreset(struct proc*);
+void            kstackmap(uint64, uint64);
+uint64          kstackunmap(uint64);
+void            asidinit(void);
+void            kvmswitch(struct proc*);
+uint64          uvmsatp(struct proc*);
+void            tlbinval(struct proc*, uint64, uint64);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
-int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopy(pagetable_t, pagetable_t, uint64, uint64, int);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+int             uvmcow(pagetable_t, uint64);
+int             uvmdemote(pagetable_t, uint64);
+int             uvmfault(pagetable_t, uint64, int);
+int             uvmzero(pagetable_t, uint64, int);
+pte_t*          walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+int             copyfault(uint64, int, int);
+
+// uaccess.S
+int             copyuser(void*, void*, uint64);
+int             copyuserstr(char*, char*, uint64);
+
+// swap.c
+void            swapinit(int, uint, uint);
+int             swapout(int);
+void*           swapkalloc(int);
+int             swapin(pagetable_t, uint64, pte_t*);
+void            swapdup(int);
+void            swapfree(int);
+
+// vma.c
+void            vmainit(void);
+void            textfree(struct inode*);
+void            textwrite(struct inode*, uint, uint);
+int             textreap(void);
+struct vma*     vmaalloc(struct vma*);
+struct vma*     vmalookup(struct vma*, uint64);
+int             vmaoverlap(struct vma*, uint64, uint64);
+void            vmadup(struct vma*, struct vma*);
+void            vmaclear(pagetable_t, struct vma*);
+void            vmatrim(struct vma*, uint64);
+int             vmafill(pagetable_t, struct vma*, uint64, int);
+uint64          vmaplace(struct vma*, uint64, uint64);
+int             vmacopy(pagetable_t, pagetable_t, struct vma*);
+int             vmaunmap(pagetable_t, struct vma*, uint64, uint64);
 
 // plic.c
 void            plicinit(void);
@@ -4,13 +4,33 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 #include "defs.h"
 #include "elf.h"
 
-static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
+// Map ELF segment flags to PTE permission bits.
+static int
+flags2perm(int flags)
+{
+  int perm = 0;
+
+  if(flags & ELF_PROG_FLAG_EXEC)
+    perm |= PTE_X;
+  if(flags & ELF_PROG_FLAG_WRITE)
+    perm |= PTE_W;
+  if(flags & ELF_PROG_FLAG_READ)
+    perm |= PTE_R;
+  return perm;
+}
 
+// Replace the user image of p, which is either the calling
+// process or a new one being set up by spawn(), with the
+// program in path. Returns argc, or -1 if the program
+// cannot be loaded, in which case p is unchanged.
 int
-exec(char *path, char **argv)
+exec(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
   int i, off;
@@ -18,9 +38,10 @@ exec(char *path, char **argv)
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
+  struct vma vma[NVMA], *v;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
 
+  memset(vma, 0, sizeof(vma));
   begin_op();
 
   if((ip = namei(path)) == 0){
@@ -38,7 +59,8 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Describe the program's segments; their pages are read
+  // in from ip on demand, when the program first uses them.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -48,30 +70,46 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
-      goto bad;
-    sz = sz1;
     if((ph.vaddr % PGSIZE) != 0)
       goto bad;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    // segments must be in address order and not overlap.
+    if(ph.vaddr < sz || ph.vaddr + ph.memsz >= TRAPFRAME)
+      goto bad;
+    if(ph.off + ph.filesz < ph.off || ph.off + ph.filesz > ip->size)
+      goto bad;
+    if(ph.memsz == 0)
+      continue;
+    if((v = vmaalloc(vma)) == 0)
       goto bad;
+    v->start = ph.vaddr;
+    v->end = ph.vaddr + ph.memsz;
+    v->perm = flags2perm(ph.flags);
+    v->ip = idup(ip);
+    v->off = ph.off;
+    v->filesz = ph.filesz;
+    sz = ph.vaddr + ph.memsz;
   }
   iunlockput(ip);
   end_op();
   ip = 0;
 
-  p = myproc();
   uint64 oldsz = p->sz;
 
-  // Allocate two pages at the next page boundary.
-  // Use the second as the user stack.
+  // At the next page boundary, a guard page and then a
+  // region of USTACKPAGES pages for the user stack. Only
+  // the top page, which holds the arguments, is allocated
+  // now; the rest are part of p->sz but not mapped, and
+  // uvmfault() allocates them as the stack grows into them.
   sz = PGROUNDUP(sz);
+  if(sz + (1 + USTACKPAGES)*PGSIZE > TRAPFRAME)
+    goto bad;
   uint64 sz1;
-  if((sz1 = uvmalloc(pagetable, sz, sz + 2*PGSIZE)) == 0)
+  if((sz1 = uvmalloc(pagetable, sz, sz + PGSIZE)) == 0)
+    goto bad;
+  uvmclear(pagetable, sz);
+  sz = sz1 + USTACKPAGES*PGSIZE;
+  if(uvmalloc(pagetable, sz - PGSIZE, sz) == 0)
     goto bad;
-  sz = sz1;
-  uvmclear(pagetable, sz-2*PGSIZE);
   sp = sz;
   stackbase = sp - PGSIZE;
 
@@ -111,10 +149,16 @@ exec(char *path, char **argv)
   // Commit to the user image.
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
+  kvmreset(p);
   p->sz = sz;
+  p->ustack = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
+  vmaclear(oldpagetable, p->vma);
   proc_freepagetable(oldpagetable, oldsz);
+  // TLB entries from the old page table have p's ASIDs.
+  tlbinval(p, 0, MAXVA / PGSIZE);
+  memmove(p->vma, vma, sizeof(vma));
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -125,30 +169,6 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  vmaclear(0, vma);
   return -1;
 }
-
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
-{
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
-  }
-  
-  return 0;
-}
@@ -5,3 +5,14 @@
 #define O_CREATE  0x200 // 2'b0010 0000 0000
 // to truncate the file to zero length.
 #define O_TRUNC   0x400 // 2'b0100 0000 0000
+
+// mmap() protections.
+#define PROT_NONE     0x0
+#define PROT_READ     0x1
+#define PROT_WRITE    0x2
+#define PROT_EXEC     0x4
+
+// mmap() flags.
+#define MAP_SHARED    0x01 // stores reach the file
+#define MAP_PRIVATE   0x02 // stores are private copy-on-write
+#define MAP_ANONYMOUS 0x20 // zero-filled, no file
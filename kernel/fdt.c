@@ -0,0 +1,146 @@
+//
+// Find out how much RAM there is from the flattened device
+// tree (FDT) that qemu's boot code passes in register a1;
+// entry.S and start() save its address in dtbpa.
+//
+// Only as much of the format is understood as is needed to
+// find the memory node's "reg" property: a list of (base,
+// size) pairs, each number #address-cells (or #size-cells)
+// 32-bit big-endian words long.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define FDT_MAGIC      0xd00dfeed
+#define FDT_BEGIN_NODE 1
+#define FDT_END_NODE   2
+#define FDT_PROP       3
+#define FDT_NOP        4
+#define FDT_END        9
+
+// the kernel's direct map must stay clear of the kernel
+// stacks and trampoline at the top of the address space.
+#define MAXPHYSTOP (1L << 37)
+
+extern uint64 dtbpa;
+
+// FDT header; all fields are big-endian.
+struct fdthdr {
+  uint magic;
+  uint totalsize;
+  uint off_dt_struct;
+  uint off_dt_strings;
+  uint off_mem_rsvmap;
+  uint version;
+  uint last_comp_version;
+  uint boot_cpuid_phys;
+  uint size_dt_strings;
+  uint size_dt_struct;
+};
+
+static uint
+be32(void *p)
+{
+  uchar *b = p;
+
+  return ((uint)b[0] << 24) | ((uint)b[1] << 16) | ((uint)b[2] << 8) | b[3];
+}
+
+// Read a number that is n 32-bit cells long.
+static uint64
+cells(uchar *p, int n)
+{
+  uint64 v = 0;
+
+  while(n-- > 0){
+    v = (v << 32) | be32(p);
+    p += 4;
+  }
+  return v;
+}
+
+// Is name the node name "memory" or "memory@..."?
+static int
+ismemory(char *name)
+{
+  return strncmp(name, "memory", 6) == 0 && (name[6] == 0 || name[6] == '@');
+}
+
+// Return the end of the RAM that contains the kernel, as
+// described by the device tree, or PHYSTOP if there is no
+// device tree or it does not say.
+uint64
+fdtphystop(void)
+{
+  struct fdthdr *h = (struct fdthdr*)dtbpa;
+  uchar *p, *end, *val;
+  char *strings, *name;
+  int depth, inmem, acells, scells, len;
+  uint64 base, size, top;
+
+  if(h == 0 || be32(&h->magic) != FDT_MAGIC)
+    return PHYSTOP;
+
+  p = (uchar*)h + be32(&h->off_dt_struct);
+  end = p + be32(&h->size_dt_struct);
+  strings = (char*)h + be32(&h->off_dt_strings);
+
+  // defaults from the devicetree specification.
+  acells = 2;
+  scells = 1;
+
+  depth = 0;
+  inmem = 0;
+  top = 0;
+  while(p < end){
+    switch(be32(p)){
+    case FDT_BEGIN_NODE:
+      name = (char*)p + 4;
+      depth++;
+      inmem = depth == 2 && ismemory(name);
+      p = (uchar*)name + ((strlen(name) + 1 + 3) & ~3);
+      break;
+    case FDT_END_NODE:
+      depth--;
+      inmem = 0;
+      p += 4;
+      break;
+    case FDT_PROP:
+      len = be32(p + 4);
+      name = strings + be32(p + 8);
+      val = p + 12;
+      p = val + ((len + 3) & ~3);
+      if(depth == 1 && strncmp(name, "#address-cells", 15) == 0)
+        acells = be32(val);
+      else if(depth == 1 && strncmp(name, "#size-cells", 12) == 0)
+        scells = be32(val);
+      else if(inmem && strncmp(name, "reg", 4) == 0){
+        for(; len >= 4 * (acells + scells); len -= 4 * (acells + scells)){
+          base = cells(val, acells);
+          size = cells(val + 4 * acells, scells);
+          val += 4 * (acells + scells);
+          if(base <= KERNBASE && KERNBASE < base + size)
+            top = base + size;
+        }
+      }
+      break;
+    case FDT_NOP:
+      p += 4;
+      break;
+    case FDT_END:
+    default:
+      p = end;
+      break;
+    }
+  }
+
+  if(top == 0)
+    return PHYSTOP;
+  if(top > MAXPHYSTOP)
+    top = MAXPHYSTOP;
+  return PGROUNDDOWN(top);
+}
@@ -1,6 +1,32 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers.
+//
+// Memory between end and phystop, the end of RAM as the
+// device tree reports it (see fdt.c), is managed by a buddy
+// allocator, which hands out naturally aligned blocks of
+// 2^order contiguous pages (kalloc_order/kfree_order).
+//
+// Single pages (kalloc/kfree) come from per-CPU free lists,
+// each protected by its own lock, so that CPUs allocating
+// and freeing at the same time don't contend. A CPU whose
+// list is empty refills it with a batch of pages from the
+// buddy allocator, or failing that steals a batch from
+// another CPU's list; a CPU whose list grows too long gives
+// a batch back to the buddy allocator, so that freed pages
+// can coalesce into larger blocks again.
+//
+// Idle CPUs keep a small pool of zero-filled pages topped
+// up (kzero_refill), from which kalloc_zeroed() serves
+// page-table and user pages without zeroing them on the
+// fork/sbrk path.
+//
+// Unless built with RELEASE, freed and newly allocated
+// pages are filled with junk to catch dangling references.
+//
+// Pages handed out by kalloc() carry a reference count, so
+// that a page can be shared (e.g. copy-on-write after fork)
+// and kfree() only frees it when the last reference goes.
 
 #include "types.h"
 #include "param.h"
@@ -9,11 +35,20 @@
 #include "riscv.h"
 #include "defs.h"
 
+#define NBATCH 32  // pages moved between lists at once
+#define NZERO  64  // pre-zeroed pages kept by kzero_refill()
+// page number of a physical address, for buddy.order[] and kref[].
+#define PA2PG(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+
 void freerange(void *pa_start, void *pa_end);
+static void kzero_drain(void);
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+uint64 phystop;    // end of RAM
+static char *base; // first page the allocator manages
+
 struct run {
   struct run *next;
 };
@@ -21,45 +56,442 @@ struct run {
 struct {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int nfree;
+} kmem[NCPU];
+
+// pool of zero-filled pages.
+struct {
+  struct spinlock lock;
+  struct run *list;
+  int n;
+} kzero;
+
+// reference counts of pages handed out by kalloc(),
+// indexed by PA2PG(); sized for phystop by kinit().
+// updated with atomic instructions rather than a lock.
+int *kref;
+
+// header at the start of a free buddy block.
+struct block {
+  struct block *next;
+  struct block *prev;
+};
+
+struct {
+  struct spinlock lock;
+  struct block free[MAXORDER+1]; // circular lists of free blocks, by order
+  uchar *order;                  // 1+order if page heads a free block, else 0
+} buddy;
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
-  freerange(end, (void*)PHYSTOP);
+  uint64 npage;
+
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
+  initlock(&buddy.lock, "kmem_buddy");
+  initlock(&kzero.lock, "kzero");
+  for(int k = 0; k <= MAXORDER; k++)
+    buddy.free[k].next = buddy.free[k].prev = &buddy.free[k];
+
+  // the per-page arrays go right after the kernel.
+  phystop = fdtphystop();
+  npage = PA2PG(phystop);
+  kref = (int*)PGROUNDUP((uint64)end);
+  buddy.order = (uchar*)(kref + npage);
+  base = (char*)PGROUNDUP((uint64)(buddy.order + npage));
+  memset(kref, 0, base - (char*)kref);
+
+  freerange(base, (void*)phystop);
+}
+
+static void
+bpush(struct block *b, int order)
+{
+  struct block *head = &buddy.free[order];
+
+  b->next = head->next;
+  b->prev = head;
+  head->next->prev = b;
+  head->next = b;
+  buddy.order[PA2PG(b)] = 1 + order;
+}
+
+static void
+bremove(struct block *b)
+{
+  b->prev->next = b->next;
+  b->next->prev = b->prev;
+  buddy.order[PA2PG(b)] = 0;
+}
+
+// Put the 2^order pages at pa on the buddy free lists,
+// merging with its buddy as long as the buddy is free too.
+// Caller must hold buddy.lock.
+static void
+bfree(uint64 pa, int order)
+{
+  uint64 bpa;
+
+  while(order < MAXORDER){
+    bpa = KERNBASE + ((pa - KERNBASE) ^ ((uint64)PGSIZE << order));
+    if(bpa >= phystop || buddy.order[PA2PG(bpa)] != 1 + order)
+      break;
+    bremove((struct block*)bpa);
+    if(bpa < pa)
+      pa = bpa;
+    order++;
+  }
+  bpush((struct block*)pa, order);
+}
+
+// Take a free block of 2^order pages off the buddy lists,
+// splitting a larger block if need be.
+// Returns 0 if there is none.
+// Caller must hold buddy.lock.
+static void*
+balloc(int order)
+{
+  struct block *b;
+  int k;
+
+  for(k = order; k <= MAXORDER; k++)
+    if(buddy.free[k].next != &buddy.free[k])
+      break;
+  if(k > MAXORDER)
+    return 0;
+
+  b = buddy.free[k].next;
+  bremove(b);
+  // give back the upper halves we don't need.
+  while(k > order){
+    k--;
+    bpush((struct block*)((char*)b + ((uint64)PGSIZE << k)), k);
+  }
+  return b;
 }
 
+// Hand the range to the buddy allocator, carved into the
+// largest aligned blocks that fit.
 void
 freerange(void *pa_start, void *pa_end)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  uint64 pa, e;
+  int order;
+
+  pa = PGROUNDUP((uint64)pa_start);
+  e = (uint64)pa_end;
+  acquire(&buddy.lock);
+  while(pa + PGSIZE <= e){
+    order = MAXORDER;
+    while(order > 0 &&
+          (((pa - KERNBASE) & (((uint64)PGSIZE << order) - 1)) != 0 ||
+           pa + ((uint64)PGSIZE << order) > e))
+      order--;
+    bfree(pa, order);
+    pa += (uint64)PGSIZE << order;
+  }
+  release(&buddy.lock);
+}
+
+// Return every page on the per-CPU free lists to the
+// buddy allocator, so that they can coalesce.
+static void
+kdrain(void)
+{
+  struct run *r, *next;
+
+  for(int i = 0; i < NCPU; i++){
+    acquire(&kmem[i].lock);
+    r = kmem[i].freelist;
+    kmem[i].freelist = 0;
+    kmem[i].nfree = 0;
+    release(&kmem[i].lock);
+
+    acquire(&buddy.lock);
+    for(; r; r = next){
+      next = r->next;
+      bfree((uint64)r, 0);
+    }
+    release(&buddy.lock);
+  }
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to their size. Returns 0 if the memory cannot be allocated.
+void *
+kalloc_order(int order)
+{
+  void *pa;
+
+  if(order < 0 || order > MAXORDER)
+    return 0;
+
+  acquire(&buddy.lock);
+  pa = balloc(order);
+  release(&buddy.lock);
+  if(pa == 0){
+    textreap();
+    kmem_cache_reap();
+    kzero_drain();
+    kdrain();
+    acquire(&buddy.lock);
+    pa = balloc(order);
+    release(&buddy.lock);
+  }
+
+#ifndef RELEASE
+  if(pa)
+    memset(pa, 5, (uint64)PGSIZE << order); // fill with junk
+#endif
+  return pa;
+}
+
+// Free 2^order pages returned by kalloc_order(order).
+void
+kfree_order(void *pa, int order)
+{
+  if(order < 0 || order > MAXORDER ||
+     ((uint64)pa % ((uint64)PGSIZE << order)) != 0 ||
+     (char*)pa < base || (uint64)pa + ((uint64)PGSIZE << order) > phystop)
+    panic("kfree_order");
+
+#ifndef RELEASE
+  // Fill with junk to catch dangling refs.
+  memset(pa, 1, (uint64)PGSIZE << order);
+#endif
+
+  acquire(&buddy.lock);
+  bfree((uint64)pa, order);
+  release(&buddy.lock);
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Allocate 2^order physically contiguous pages, aligned to
+// their size, as separate pages that each have a reference
+// count, so that they can be shared (krefinc()) and freed
+// (kfree()) one by one. Used for user megapages.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_pages(int order)
+{
+  char *pa;
+  int i;
+
+  if((pa = kalloc_order(order)) == 0)
+    return 0;
+  for(i = 0; i < (1 << order); i++)
+    kref[PA2PG(pa) + i] = 1;
+  return pa;
+}
+
+// Drop a reference to the page of physical memory
+// pointed at by pa, which must have been returned by a
+// call to kalloc(), and free it if that was the last one.
+// The page goes on the free list of the calling CPU;
+// if that list has grown long, a batch of it goes
+// back to the buddy allocator.
 void
 kfree(void *pa)
+{
+  kfree_batch(&pa, 1);
+}
+
+// kfree() each of the n pages in pa[], taking the calling
+// CPU's free-list lock, and the buddy allocator's if the
+// list grows too long, once for all of them.
+void
+kfree_batch(void **pa, int n)
+{
+  struct run *r, *head, *tail, *batch, *next;
+  int i, nfree, ref, id;
+
+  head = tail = 0;
+  nfree = 0;
+  for(i = 0; i < n; i++){
+    if(((uint64)pa[i] % PGSIZE) != 0 || (char*)pa[i] < base || (uint64)pa[i] >= phystop)
+      panic("kfree");
+
+    ref = __sync_sub_and_fetch(&kref[PA2PG(pa[i])], 1);
+    if(ref > 0)
+      continue;
+    if(ref < 0)
+      panic("kfree: ref");
+
+#ifndef RELEASE
+    // Fill with junk to catch dangling refs.
+    memset(pa[i], 1, PGSIZE);
+#endif
+
+    r = (struct run*)pa[i];
+    r->next = head;
+    head = r;
+    if(tail == 0)
+      tail = r;
+    nfree++;
+  }
+  if(head == 0)
+    return;
+
+  batch = 0;
+  push_off();
+  id = cpuid();
+  acquire(&kmem[id].lock);
+  tail->next = kmem[id].freelist;
+  kmem[id].freelist = head;
+  kmem[id].nfree += nfree;
+  if(kmem[id].nfree > 2*NBATCH){
+    // keep the NBATCH most recently freed pages and
+    // detach the rest.
+    r = kmem[id].freelist;
+    for(i = 1; i < NBATCH; i++)
+      r = r->next;
+    batch = r->next;
+    r->next = 0;
+    kmem[id].nfree = NBATCH;
+  }
+  release(&kmem[id].lock);
+  pop_off();
+
+  if(batch){
+    acquire(&buddy.lock);
+    for(r = batch; r; r = next){
+      next = r->next;
+      bfree((uint64)r, 0);
+    }
+    release(&buddy.lock);
+  }
+}
+
+// Put the list of n pages from r to tail on CPU id's
+// free list.
+static void
+kpush(int id, struct run *r, struct run *tail, int n)
+{
+  acquire(&kmem[id].lock);
+  tail->next = kmem[id].freelist;
+  kmem[id].freelist = r;
+  kmem[id].nfree += n;
+  release(&kmem[id].lock);
+}
+
+// Take up to NBATCH single pages from the buddy allocator.
+// Return one of them and put the rest on CPU id's list.
+// Returns 0 if the buddy allocator is out of memory.
+static struct run*
+krefill(int id)
+{
+  struct run *r, *head, *tail;
+  int n;
+
+  head = tail = 0;
+  acquire(&buddy.lock);
+  for(n = 0; n < NBATCH; n++){
+    if((r = balloc(0)) == 0)
+      break;
+    r->next = head;
+    head = r;
+    if(tail == 0)
+      tail = r;
+  }
+  release(&buddy.lock);
+
+  if(n > 1)
+    kpush(id, head->next, tail, n - 1);
+  return head;
+}
+
+// Take up to NBATCH pages from some other CPU's free list.
+// Return one of them and put the rest on CPU id's list.
+// Returns 0 if every list is empty.
+// Only one kmem lock is held at a time, so two CPUs
+// stealing from each other cannot deadlock.
+static struct run*
+ksteal(int id)
+{
+  struct run *r, *tail;
+  int i, n;
+
+  for(i = 1; i < NCPU; i++){
+    int victim = (id + i) % NCPU;
+
+    acquire(&kmem[victim].lock);
+    r = kmem[victim].freelist;
+    if(r == 0){
+      release(&kmem[victim].lock);
+      continue;
+    }
+    tail = r;
+    for(n = 1; n < NBATCH && tail->next; n++)
+      tail = tail->next;
+    kmem[victim].freelist = tail->next;
+    kmem[victim].nfree -= n;
+    release(&kmem[victim].lock);
+
+    if(r != tail)
+      kpush(id, r->next, tail, n - 1);
+    return r;
+  }
+  return 0;
+}
+
+// Take a page off this CPU's free list, refilling the
+// list from the buddy allocator or other CPUs if it is
+// empty, and give it a reference count of one.
+// Returns 0 if there is none.
+static struct run*
+kget(void)
 {
   struct run *r;
+  int id;
 
-  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
-    panic("kfree");
+  push_off();
+  id = cpuid();
+  acquire(&kmem[id].lock);
+  r = kmem[id].freelist;
+  if(r){
+    kmem[id].freelist = r->next;
+    kmem[id].nfree--;
+  }
+  release(&kmem[id].lock);
+  if(r == 0)
+    r = krefill(id);
+  if(r == 0)
+    r = ksteal(id);
+  pop_off();
 
-  // Fill with junk to catch dangling refs.
-  memset(pa, 1, PGSIZE);
+  if(r)
+    kref[PA2PG(r)] = 1;
+  return r;
+}
 
-  r = (struct run*)pa;
+// Take a page from the zero pool, or return 0.
+// The page is entirely zero.
+static struct run*
+kzero_pop(void)
+{
+  struct run *r;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  acquire(&kzero.lock);
+  r = kzero.list;
+  if(r){
+    kzero.list = r->next;
+    kzero.n--;
+  }
+  release(&kzero.lock);
+  if(r)
+    r->next = 0;
+  return r;
+}
+
+// Give the pages in the zero pool back to the free lists.
+static void
+kzero_drain(void)
+{
+  struct run *r;
+
+  while((r = kzero_pop()) != 0)
+    kfree(r);
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -70,13 +502,78 @@ kalloc(void)
 {
   struct run *r;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  r = kget();
+
+  // a pre-zeroed page is as good as any.
+  if(r == 0)
+    r = kzero_pop();
 
+  // give memory held by the text and object caches
+  // back and retry.
+  if(r == 0 && textreap() + kmem_cache_reap() > 0)
+    return kalloc();
+
+#ifndef RELEASE
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
   return (void*)r;
 }
+
+// Allocate one zero-filled page.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  void *pa;
+
+  if((pa = kzero_pop()) != 0)
+    return pa;
+  if((pa = kalloc()) != 0)
+    memset(pa, 0, PGSIZE);
+  return pa;
+}
+
+// Zero one free page and add it to the zero pool, unless
+// the pool is full or memory is short. Called by idle CPUs
+// from scheduler(); doing one page at a time keeps a CPU
+// from sitting here when a process becomes runnable.
+void
+kzero_refill(void)
+{
+  struct run *r;
+
+  if(kzero.n >= NZERO)
+    return;
+  if((r = kget()) == 0)
+    return;
+  memset(r, 0, PGSIZE);
+
+  acquire(&kzero.lock);
+  if(kzero.n < NZERO){
+    r->next = kzero.list;
+    kzero.list = r;
+    kzero.n++;
+    r = 0;
+  }
+  release(&kzero.lock);
+
+  if(r)
+    kfree(r);
+}
+
+// Add a reference to a page returned by kalloc().
+void
+krefinc(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < base || (uint64)pa >= phystop)
+    panic("krefinc");
+  __sync_fetch_and_add(&kref[PA2PG(pa)], 1);
+}
+
+// Return the number of references to a page returned by kalloc().
+int
+krefcnt(void *pa)
+{
+  return __atomic_load_n(&kref[PA2PG(pa)], __ATOMIC_SEQ_CST);
+}
@@ -17,8 +17,10 @@ main()
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    slabinit();      // kernel object caches
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
+    asidinit();      // address-space identifiers
     procinit();      // process table
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
@@ -27,6 +29,12 @@ main()
     binit();         // buffer cache
     iinit();         // inode table
     fileinit();      // file table
+    pipeinit();      // pipe cache
+    vmainit();       // shared program text cache
+    shminit();       // shared-memory segments
+#ifdef LAB_LOCK
+    statsinit();     // statistics device
+#endif
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
@@ -14,8 +14,9 @@
 
 // the kernel uses physical memory thus:
 // 80000000 -- entry.S, then kernel text and data
-// end -- start of kernel page allocation area
-// PHYSTOP -- end RAM used by the kernel
+// end -- page reference counts, buddy allocator state
+//        then kernel page allocation area
+// phystop -- end RAM used by the kernel
 
 // qemu puts UART registers here in physical memory.
 #define UART0 0x10000000L
@@ -43,7 +44,10 @@
 
 // the kernel expects there to be RAM
 // for use by the kernel and user pages
-// from physical address 0x80000000 to PHYSTOP.
+// from physical address 0x80000000 to phystop,
+// which kinit() finds in the device tree.
+// PHYSTOP is the end of RAM it assumes if the
+// device tree doesn't say (qemu's -m 128M).
 #define KERNBASE 0x80000000L
 #define PHYSTOP (KERNBASE + 128*1024*1024)
 
@@ -53,6 +57,8 @@
 
 // map kernel stacks beneath the trampoline,
 // each surrounded by invalid guard pages.
+// there are NPROC slots; one is mapped only
+// while a process is using it.
 #define KSTACK(p) (TRAMPOLINE - ((p)+1)* 2*PGSIZE)
 
 // User memory layout.
@@ -65,3 +71,9 @@
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// each process's kernel page table (p->kpagetable) also
+// maps the process's user memory, at UALIAS + the user
+// address, in the upper half of the Sv39 address space,
+// so that copyin() and copyout() can reach it directly.
+#define UALIAS 0xFFFFFFC000000000L
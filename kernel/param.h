@@ -1,4 +1,4 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC      4096  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
@@ -11,3 +11,14 @@
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       1000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
+#define MAXORDER     10    // kalloc_order() blocks are up to 2^MAXORDER pages
+#define NVMA         16    // program segments and mapped areas per process
+#define NSHM         32    // shared-memory segments per system
+#define SHMMAXPG     512   // maximum pages in a shared-memory segment
+#define NSWAP        8192  // size of swap area in blocks, after the file system
+#define USTACKPAGES  256   // maximum user stack size, in pages
+#define NPRIO        4     // scheduling priority levels
+#define BOOSTTICKS   20    // ticks between priority boosts
+#define NWAITQ       64    // wait-channel hash buckets for sleep()
+#define NWHEEL       64    // slots in the timer wheel for sleeptimed()
+#define NPIDHASH    256    // pid hash chains in the process table
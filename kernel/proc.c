@@ -8,15 +8,112 @@
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
-
 struct proc *initproc;
 
-int nextpid = 1;
-struct spinlock pid_lock;
+// The process table. allocproc() makes each struct proc,
+// and maps a page in a free KSTACK() slot for its kernel
+// stack, as it is needed, and freeproc() frees them when
+// the parent's wait() is done with the zombie; in between,
+// the process can be found by its pid in a hash table,
+// whose chains are in decreasing pid order. A process's
+// children are on a list that starts at p->child, so
+// wait() and reparent() need not look at any others.
+//
+// Lock order: proctab.lock, then a p->lock. kill() and
+// procsweep() look up a process and lock it with
+// proctab.lock held, so freeproc() takes p out of the table
+// only after releasing p->lock, and frees it only once any
+// of them that found it first has let go of p->lock.
+struct {
+  struct spinlock lock;
+  struct proc *pid[NPIDHASH];  // hash chains, linked by p->pidnext
+  int nextpid;
+  int freestack[NPROC];        // KSTACK() slots not in use
+  int nfree;
+  struct kmem_cache *cache;
+} proctab;
+
+// Per-CPU run queues of RUNNABLE processes. A process goes
+// on the queue of the CPU it last ran on (p->cpu), or for a
+// new process that of its parent's CPU, and each CPU's
+// scheduler takes processes from its own queue, so that they
+// tend to stay where their cache and TLB entries are. A CPU
+// whose queue is empty, or two or more shorter than the
+// longest, takes the next process from the longest instead.
+//
+// Scheduling is a multi-level feedback queue: a queue has a
+// FIFO list for each of NPRIO priority levels, and the
+// scheduler runs the first process of the highest level
+// that has one. A process at level l may run for 2^l ticks
+// (schedtick()) before it is preempted and moves down a
+// level; one that sleeps before then keeps its level, so
+// interactive and I/O-bound processes stay above CPU-bound
+// ones. Every BOOSTTICKS ticks, runqboost() moves every
+// process back to the top, so that none starves. A process's
+// nice value keeps it from rising above prio0().
+//
+// A queue's lock may be acquired while holding a p->lock,
+// but not the other way around: the scheduler takes a
+// process off a queue, releases the queue, and only then
+// acquires the process's lock.
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];    // a list for each level
+  struct proc *tail[NPRIO];
+  int n;                       // processes on the queue
+} runq[NCPU];
+
+// Wait queues of sleeping processes, hashed by the channel
+// they sleep on, so that wakeup() only looks at processes
+// that may be sleeping on its channel. A process puts
+// itself on the queue in sleep(), with p->chan already set,
+// and takes itself off when it wakes up; wakeup() only
+// changes the state of those it finds, so a process that
+// kill() woke, or that is on its way out of sleep(), may
+// still be on a queue with p->chan cleared.
+//
+// Lock order: a wait queue's lock, then a p->lock.
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+} waitq[NWAITQ];
+
+static struct waitq*
+waitqof(void *chan)
+{
+  return &waitq[((uint64)chan * 0x9E3779B97F4A7C15UL) >> 58 & (NWAITQ - 1)];
+}
+
+// Deadlines of processes in sleeptimed(), kept in a hashed
+// timer wheel: slot d % NWHEEL holds the processes whose
+// deadline is tick d, so that timertick() only looks at the
+// processes due at this tick, and at those a multiple of
+// NWHEEL ticks later. As with the wait queues, a process
+// puts itself on the wheel and takes itself off when it
+// wakes, unless timertick() has already taken it off.
+// Deadlines count from wheel.now, the last tick timertick()
+// has looked at, not from ticks, which may already be one
+// ahead: a deadline from ticks could fall on a tick whose
+// slot was looked at before the process got onto it.
+//
+// Lock order: the wheel's lock, then a wait queue's lock,
+// then a p->lock.
+struct {
+  struct spinlock lock;
+  struct proc *slot[NWHEEL];
+  uint now;
+} wheel;
+
+// priority boosts so far; a process whose p->boostgen is
+// older has not had its level reset yet.
+uint boostgen;
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void addchild(struct proc *parent, struct proc *p);
+static void runqput(struct proc *p, int cpu);
+static void reprio(struct proc *p);
+static int prio0(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
@@ -26,34 +123,22 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
-// Allocate a page for each process's kernel stack.
-// Map it high in memory, followed by an invalid
-// guard page.
-void
-proc_mapstacks(pagetable_t kpgtbl) {
-  struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++) {
-    char *pa = kalloc();
-    if(pa == 0)
-      panic("kalloc");
-    uint64 va = KSTACK((int) (p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
-  }
-}
-
 // initialize the proc table at boot time.
 void
 procinit(void)
 {
-  struct proc *p;
-  
-  initlock(&pid_lock, "nextpid");
+  initlock(&proctab.lock, "proctab");
+  proctab.nextpid = 1;
+  for(int i = 0; i < NPROC; i++)
+    proctab.freestack[i] = NPROC - 1 - i;
+  proctab.nfree = NPROC;
+  proctab.cache = kmem_cache_create("proc", sizeof(struct proc));
   initlock(&wait_lock, "wait_lock");
-  for(p = proc; p < &proc[NPROC]; p++) {
-      initlock(&p->lock, "proc");
-      p->kstack = KSTACK((int) (p - proc));
-  }
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
+  initlock(&wheel.lock, "wheel");
 }
 
 // Must be called with interrupts disabled,
@@ -85,45 +170,49 @@ myproc(void) {
   return p;
 }
 
-int
-allocpid() {
-  int pid;
-  
-  acquire(&pid_lock);
-  pid = nextpid;
-  nextpid = nextpid + 1;
-  release(&pid_lock);
-
-  return pid;
-}
-
-// Look in the process table for an UNUSED proc.
-// If found, initialize state required to run in the kernel,
-// and return with p->lock held.
-// If there are no free procs, or a memory allocation fails, return 0.
+// Make a new proc, with a kernel stack and a pid, and put
+// it in the process table. If that works, initialize state
+// required to run in the kernel, and return with p->lock held.
+// If there are NPROC procs already, or a memory allocation
+// fails, return 0.
 static struct proc*
 allocproc(void)
 {
   struct proc *p;
+  struct proc **h;
+  char *stack;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
-    }
+  if((p = kmem_cache_alloc(proctab.cache)) == 0)
+    return 0;
+  memset(p, 0, sizeof(*p));
+  initlock(&p->lock, "proc");
+  if((stack = kalloc()) == 0){
+    kmem_cache_free(proctab.cache, p);
+    return 0;
   }
-  return 0;
 
-found:
-  p->pid = allocpid();
+  acquire(&proctab.lock);
+  if(proctab.nfree == 0){
+    release(&proctab.lock);
+    kfree(stack);
+    kmem_cache_free(proctab.cache, p);
+    return 0;
+  }
+  p->kstack = KSTACK(proctab.freestack[--proctab.nfree]);
+  kstackmap(p->kstack, (uint64)stack);
+  p->pid = proctab.nextpid++;
+  h = &proctab.pid[p->pid % NPIDHASH];
+  p->pidnext = *h;
+  *h = p;
+  release(&proctab.lock);
+
+  acquire(&p->lock);
   p->state = USED;
+  p->boostgen = boostgen;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
     freeproc(p);
-    release(&p->lock);
     return 0;
   }
 
@@ -131,7 +220,12 @@ found:
   p->pagetable = proc_pagetable(p);
   if(p->pagetable == 0){
     freeproc(p);
-    release(&p->lock);
+    return 0;
+  }
+
+  // A kernel page table, for running in the kernel.
+  if((p->kpagetable = kvmcreate()) == 0){
+    freeproc(p);
     return 0;
   }
 
@@ -146,24 +240,48 @@ found:
 
 // free a proc structure and the data hanging from it,
 // including user pages.
-// p->lock must be held.
+// p->lock must be held; freeproc() releases it.
+// p must not be on its parent's list of children.
 static void
 freeproc(struct proc *p)
 {
+  struct proc **h;
+  uint64 stack;
+
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
-  p->sz = 0;
-  p->pid = 0;
-  p->parent = 0;
-  p->name[0] = 0;
-  p->chan = 0;
-  p->killed = 0;
-  p->xstate = 0;
+  if(p->kpagetable)
+    kfree((void*)p->kpagetable);
+  p->kpagetable = 0;
   p->state = UNUSED;
+  release(&p->lock);
+
+  // kill() may have found p, and be waiting for p->lock
+  // with proctab.lock held; once p is out of the table,
+  // no one else can find it.
+  acquire(&proctab.lock);
+  for(h = &proctab.pid[p->pid % NPIDHASH]; *h != p; h = &(*h)->pidnext)
+    ;
+  *h = p->pidnext;
+  stack = kstackunmap(p->kstack);
+  proctab.freestack[proctab.nfree++] = (TRAMPOLINE - p->kstack) / (2*PGSIZE) - 1;
+  release(&proctab.lock);
+
+  // procsweep() returns p locked, but without proctab.lock;
+  // wait for a caller that found p before it left the table
+  // to see that it is UNUSED and let go.
+  acquire(&p->lock);
+  release(&p->lock);
+
+#ifdef LAB_LOCK
+  freelock(&p->lock);
+#endif
+  kfree((void*)stack);
+  kmem_cache_free(proctab.cache, p);
 }
 
 // Create a user page table for a given process,
@@ -242,26 +360,34 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  runqput(p, cpuid());
 
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
+// Growing only moves p->sz; the new pages are
+// allocated when first touched (see uvmfault()).
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
 {
-  uint sz;
+  uint64 sz;
   struct proc *p = myproc();
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+    if(sz + n > TRAPFRAME || vmaoverlap(p->vma, PGROUNDUP(sz), PGROUNDUP(sz + n)))
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
+    // a megapage that would be cut in two must be
+    // split into pages first.
+    if(PGROUNDUP(sz + n) % MEGAPGSIZE != 0 &&
+       uvmdemote(p->pagetable, PGROUNDUP(sz + n)) < 0)
+      return -1;
     sz = uvmdealloc(p->pagetable, sz, sz + n);
+    vmatrim(p->vma, sz);
   }
   p->sz = sz;
   return 0;
@@ -276,18 +402,28 @@ fork(void)
   struct proc *np;
   struct proc *p = myproc();
 
+retry:
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
   }
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  // Copy user memory from parent to child. np->sz is set
+  // first, so that freeproc() frees the heap if the copy
+  // of the mmap() areas fails.
+  np->sz = p->sz;
+  if(uvmcopy(p->pagetable, np->pagetable, 0, p->sz, 0) < 0 ||
+     vmacopy(p->pagetable, np->pagetable, p->vma) < 0){
     freeproc(np);
-    release(&np->lock);
+    // out of memory for page tables: make room and try again.
+    if(swapout(16) > 0)
+      goto retry;
     return -1;
   }
-  np->sz = p->sz;
+  np->ustack = p->ustack;
+  np->nice = p->nice;
+  np->prio = prio0(np);
+  vmadup(np->vma, p->vma);
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -308,16 +444,100 @@ fork(void)
   release(&np->lock);
 
   acquire(&wait_lock);
-  np->parent = p;
+  addchild(p, np);
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  runqput(np, cpuid());
+  release(&np->lock);
+
+  return pid;
+}
+
+// Create a child process running the program path with
+// arguments argv, without copying the caller's memory
+// only to throw it away, as fork() followed by exec()
+// would. If fds is not 0, the child's descriptors 0, 1
+// and 2 are fds[0], fds[1] and fds[2] (0 for closed) and
+// it gets no others; otherwise it inherits all of the
+// caller's. Returns the child's pid, or -1 if the program
+// cannot be loaded.
+int
+spawn(char *path, char **argv, struct file **fds)
+{
+  int i, pid, argc;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  // Allocate process.
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+  // np is USED but has no parent yet, so nothing else will
+  // look at it while exec() sleeps reading the program.
+  release(&np->lock);
+
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  if((argc = exec(np, path, argv)) < 0){
+    acquire(&np->lock);
+    freeproc(np);
+    return -1;
+  }
+  np->trapframe->a0 = argc;
+
+  if(fds){
+    for(i = 0; i < 3; i++)
+      if(fds[i])
+        np->ofile[i] = filedup(fds[i]);
+  } else {
+    for(i = 0; i < NOFILE; i++)
+      if(p->ofile[i])
+        np->ofile[i] = filedup(p->ofile[i]);
+  }
+  np->cwd = idup(p->cwd);
+  np->nice = p->nice;
+  np->prio = prio0(np);
+
+  pid = np->pid;
+
+  acquire(&wait_lock);
+  addchild(p, np);
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  runqput(np, cpuid());
   release(&np->lock);
 
   return pid;
 }
 
+// Make p a child of parent.
+// Caller must hold wait_lock.
+static void
+addchild(struct proc *parent, struct proc *p)
+{
+  p->parent = parent;
+  p->sibprev = 0;
+  p->sibnext = parent->child;
+  if(parent->child)
+    parent->child->sibprev = p;
+  parent->child = p;
+}
+
+// Take p off its parent's list of children.
+// Caller must hold wait_lock.
+static void
+delchild(struct proc *p)
+{
+  if(p->sibprev)
+    p->sibprev->sibnext = p->sibnext;
+  else
+    p->parent->child = p->sibnext;
+  if(p->sibnext)
+    p->sibnext->sibprev = p->sibprev;
+  p->parent = 0;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
@@ -325,12 +545,20 @@ reparent(struct proc *p)
 {
   struct proc *pp;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    if(pp->parent == p){
-      pp->parent = initproc;
-      wakeup(initproc);
-    }
+  if(p->child == 0)
+    return;
+  for(pp = p->child; ; pp = pp->sibnext){
+    pp->parent = initproc;
+    if(pp->sibnext == 0)
+      break;
   }
+  // splice the whole list onto the front of init's.
+  pp->sibnext = initproc->child;
+  if(initproc->child)
+    initproc->child->sibprev = pp;
+  initproc->child = p->child;
+  p->child = 0;
+  wakeup(initproc);
 }
 
 // Exit the current process.  Does not return.
@@ -358,6 +586,8 @@ exit(int status)
   end_op();
   p->cwd = 0;
 
+  vmaclear(p->pagetable, p->vma);
+
   acquire(&wait_lock);
 
   // Give any children to init.
@@ -384,36 +614,39 @@ int
 wait(uint64 addr)
 {
   struct proc *np;
-  int havekids, pid;
+  int havekids, pid, xstate;
   struct proc *p = myproc();
 
   acquire(&wait_lock);
 
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through our children looking for exited ones.
     havekids = 0;
-    for(np = proc; np < &proc[NPROC]; np++){
-      if(np->parent == p){
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&np->lock);
-
-        havekids = 1;
-        if(np->state == ZOMBIE){
-          // Found one.
-          pid = np->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                  sizeof(np->xstate)) < 0) {
-            release(&np->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(np);
-          release(&np->lock);
-          release(&wait_lock);
-          return pid;
-        }
+    for(np = p->child; np; np = np->sibnext){
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&np->lock);
+
+      havekids = 1;
+      if(np->state == ZOMBIE){
+        // Found one.
+        // copyout() may have to sleep to fault in the page
+        // at addr, so drop the locks around it; np stays a
+        // zombie, since only its parent can free it.
+        pid = np->pid;
+        xstate = np->xstate;
         release(&np->lock);
+        release(&wait_lock);
+        if(addr != 0 && copyout(p->pagetable, addr, (char *)&xstate,
+                                sizeof(xstate)) < 0)
+          return -1;
+        acquire(&wait_lock);
+        acquire(&np->lock);
+        delchild(np);
+        freeproc(np);
+        release(&wait_lock);
+        return pid;
       }
+      release(&np->lock);
     }
 
     // No point waiting if we don't have any children.
@@ -427,6 +660,189 @@ wait(uint64 addr)
   }
 }
 
+// Make p RUNNABLE and put it at the tail of CPU cpu's run
+// queue. Caller must hold p->lock.
+static void
+runqput(struct proc *p, int cpu)
+{
+  struct runq *q = &runq[cpu];
+  int l;
+
+  p->state = RUNNABLE;
+  p->cpu = cpu;
+  p->rqnext = 0;
+  reprio(p);
+  l = p->prio;
+  acquire(&q->lock);
+  if(q->tail[l])
+    q->tail[l]->rqnext = p;
+  else
+    q->head[l] = p;
+  q->tail[l] = p;
+  q->n++;
+  release(&q->lock);
+}
+
+// Take the first process of the highest level of q
+// that has one, or return 0.
+static struct proc*
+runqpop(struct runq *q)
+{
+  struct proc *p;
+  int l;
+
+  p = 0;
+  acquire(&q->lock);
+  for(l = 0; l < NPRIO; l++){
+    if((p = q->head[l]) != 0){
+      q->head[l] = p->rqnext;
+      if(q->head[l] == 0)
+        q->tail[l] = 0;
+      q->n--;
+      p->rqnext = 0;
+      break;
+    }
+  }
+  release(&q->lock);
+  return p;
+}
+
+// The highest level p may have, given its nice value.
+static int
+prio0(struct proc *p)
+{
+  return p->nice * NPRIO / 20;
+}
+
+// Move p to the top level it may have if there has been
+// a priority boost since it last looked. Caller must hold
+// p->lock.
+static void
+reprio(struct proc *p)
+{
+  if(p->boostgen != boostgen){
+    p->boostgen = boostgen;
+    p->prio = prio0(p);
+    p->ticks = 0;
+  }
+}
+
+// Move every queued process to the top level its nice
+// value allows, keeping the order within each level.
+// Queued processes' p->prio is fixed when they next run or
+// are queued (reprio()); running and sleeping ones are
+// fixed the same way. p->nice needs no p->lock: only p
+// changes it, and a queued process is not running.
+// Called by clockintr() every BOOSTTICKS ticks.
+void
+runqboost(void)
+{
+  struct runq *q;
+  struct proc *p, *next;
+  int l, top;
+
+  __sync_fetch_and_add(&boostgen, 1);
+  for(q = runq; q < &runq[NCPU]; q++){
+    acquire(&q->lock);
+    for(l = 1; l < NPRIO; l++){
+      p = q->head[l];
+      q->head[l] = q->tail[l] = 0;
+      for(; p; p = next){
+        next = p->rqnext;
+        top = prio0(p) < l ? prio0(p) : l;
+        p->rqnext = 0;
+        if(q->tail[top])
+          q->tail[top]->rqnext = p;
+        else
+          q->head[top] = p;
+        q->tail[top] = p;
+      }
+    }
+    release(&q->lock);
+  }
+}
+
+// Charge the current process for a timer tick. Returns 1
+// if it should give up the CPU: it has used up its time at
+// its level, and moves down one, or a process of a higher
+// level is waiting on this CPU's queue.
+int
+schedtick(void)
+{
+  struct proc *p = myproc();
+  struct runq *q;
+  int l, r;
+
+  if(p == 0)
+    return 0;
+  acquire(&p->lock);
+  reprio(p);
+  r = 0;
+  if(++p->ticks >= (1 << p->prio)){
+    if(p->prio < NPRIO - 1)
+      p->prio++;
+    p->ticks = 0;
+    r = 1;
+  } else {
+    // a peek without the queue's lock is good enough.
+    q = &runq[cpuid()];
+    for(l = 0; l < p->prio; l++)
+      if(q->head[l])
+        r = 1;
+  }
+  release(&p->lock);
+  return r;
+}
+
+// Add inc to the current process's nice value, keeping it
+// within 0 to 19, and return the new value. A process may
+// only make itself nicer.
+int
+nice(int inc)
+{
+  struct proc *p = myproc();
+  int n;
+
+  acquire(&p->lock);
+  n = p->nice + inc;
+  if(n < p->nice)
+    n = p->nice;
+  if(n > 19)
+    n = 19;
+  p->nice = n;
+  if(p->prio < prio0(p)){
+    p->prio = prio0(p);
+    p->ticks = 0;
+  }
+  release(&p->lock);
+  return n;
+}
+
+// Choose the next process for CPU id: from its own run
+// queue, unless that is empty or the longest queue is two
+// or more longer, in which case steal from the longest.
+// The lengths are read without locks; a wrong guess only
+// means a less even balance, or another try.
+static struct proc*
+runqget(int id)
+{
+  struct proc *p;
+  int i, busiest;
+
+  busiest = id;
+  for(i = 0; i < NCPU; i++)
+    if(runq[i].n > runq[busiest].n)
+      busiest = i;
+  if(busiest != id && runq[busiest].n >= runq[id].n + 2 &&
+     (p = runqpop(&runq[busiest])) != 0)
+    return p;
+  if((p = runqpop(&runq[id])) != 0)
+    return p;
+  if(busiest != id)
+    return runqpop(&runq[busiest]);
+  return 0;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -439,28 +855,43 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
   
   c->proc = 0;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
+    if((p = runqget(id)) == 0){
+      // Nothing to run; spend the time zeroing
+      // pages for kalloc_zeroed().
+      kzero_refill();
+      continue;
+    }
+
+    // p may still be on its way out of another CPU, which
+    // holds p->lock until it is back in its scheduler.
+    acquire(&p->lock);
+    if(p->state == RUNNABLE) {
+      reprio(p);
+
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      p->state = RUNNING;
+      p->cpu = id;
+      c->proc = p;
+      kvmswitch(p);
+      swtch(&c->context, &p->context);
+
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      // Leave its kernel page table while p->lock still
+      // keeps wait() from freeing it.
+      kvmswitch(0);
+      c->proc = 0;
     }
+    release(&p->lock);
   }
 }
 
@@ -497,7 +928,7 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  runqput(p, cpuid());
   sched();
   release(&p->lock);
 }
@@ -523,35 +954,135 @@ forkret(void)
   usertrapret();
 }
 
-// Atomically release lock and sleep on chan.
-// Reacquires lock when awakened.
-void
-sleep(void *chan, struct spinlock *lk)
+// Take p off the timer wheel. Caller holds wheel.lock.
+static void
+timerdel(struct proc *p)
+{
+  if(p->tmprev)
+    p->tmprev->tmnext = p->tmnext;
+  else
+    wheel.slot[p->deadline % NWHEEL] = p->tmnext;
+  if(p->tmnext)
+    p->tmnext->tmprev = p->tmprev;
+  p->timed = 0;
+}
+
+// sleep() and sleeptimed(): if n is not 0, also put p on
+// the timer wheel to be woken n ticks from now.
+// Returns 1 if timertick() woke p (or took it off the wheel
+// while it was waking up), 0 if not.
+static int
+sleepon(void *chan, struct spinlock *lk, uint n)
 {
   struct proc *p = myproc();
+  struct waitq *q = waitqof(chan);
+  int timed = n != 0;
+  int expired = 0;
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we are on chan's wait queue (and the
+  // timer wheel) and hold p->lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
-  // so it's okay to release lk.
+  // (wakeup and timertick look at the queues
+  // and lock p->lock), so it's okay to release lk.
 
+  if(timed)
+    acquire(&wheel.lock);
+  acquire(&q->lock);
   acquire(&p->lock);  //DOC: sleeplock1
+  p->chan = chan;
+  p->wqprev = 0;
+  p->wqnext = q->head;
+  if(q->head)
+    q->head->wqprev = p;
+  q->head = p;
+  release(&q->lock);
+  if(timed){
+    p->timed = 1;
+    p->deadline = wheel.now + n;
+    p->tmprev = 0;
+    p->tmnext = wheel.slot[p->deadline % NWHEEL];
+    if(p->tmnext)
+      p->tmnext->tmprev = p;
+    wheel.slot[p->deadline % NWHEEL] = p;
+    release(&wheel.lock);
+  }
   release(lk);
 
   // Go to sleep.
-  p->chan = chan;
   p->state = SLEEPING;
 
   sched();
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  if(timed){
+    acquire(&wheel.lock);
+    if(p->timed)
+      timerdel(p);
+    else
+      expired = 1;
+    release(&wheel.lock);
+  }
+
+  acquire(&q->lock);
+  if(p->wqprev)
+    p->wqprev->wqnext = p->wqnext;
+  else
+    q->head = p->wqnext;
+  if(p->wqnext)
+    p->wqnext->wqprev = p->wqprev;
+  release(&q->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
+  return expired;
+}
+
+// Atomically release lock and sleep on chan.
+// Reacquires lock when awakened.
+void
+sleep(void *chan, struct spinlock *lk)
+{
+  sleepon(chan, lk, 0);
+}
+
+// Like sleep(), but give up waiting after n ticks even if
+// no one calls wakeup(chan). Returns 1 if the time ran out,
+// 0 if the process was woken some other way (or may have
+// been: like sleep(), it can return early, and callers
+// should check their condition again).
+int
+sleeptimed(void *chan, struct spinlock *lk, uint n)
+{
+  if(n == 0)
+    return 1;
+  return sleepon(chan, lk, n);
+}
+
+// Wake up the processes whose sleeptimed() deadline is now.
+// Called by clockintr() after every tick.
+void
+timertick(uint now)
+{
+  struct proc *p, *next;
+
+  acquire(&wheel.lock);
+  wheel.now = now;
+  for(p = wheel.slot[now % NWHEEL]; p; p = next){
+    next = p->tmnext;
+    if((int)(now - p->deadline) < 0)
+      continue;
+    timerdel(p);
+    acquire(&p->lock);
+    if(p->state == SLEEPING)
+      runqput(p, p->cpu);
+    release(&p->lock);
+  }
+  release(&wheel.lock);
 }
 
 // Wake up all processes sleeping on chan.
@@ -559,17 +1090,22 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
+  struct waitq *q = waitqof(chan);
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
+  acquire(&q->lock);
+  for(p = q->head; p; p = p->wqnext) {
+    // p->chan only changes under q->lock while p is on
+    // the queue, except to be cleared when p wakes.
+    if(p != myproc() && p->chan == chan){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+        runqput(p, p->cpu);
       }
       release(&p->lock);
     }
   }
+  release(&q->lock);
 }
 
 // Kill the process with the given pid.
@@ -580,22 +1116,54 @@ kill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
+  if(pid <= 0)
+    return -1;
+  acquire(&proctab.lock);
+  for(p = proctab.pid[pid % NPIDHASH]; p; p = p->pidnext){
     if(p->pid == pid){
+      acquire(&p->lock);
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        runqput(p, p->cpu);
       }
       release(&p->lock);
+      release(&proctab.lock);
       return 0;
     }
-    release(&p->lock);
   }
+  release(&proctab.lock);
   return -1;
 }
 
+// For swapout()'s clock sweep over every process: return
+// the process with pid *pid, or if next is set or there is
+// none, the one after it in the order of the pid hash table,
+// with its p->lock held, and set *pid to its pid. *pid == 0
+// is the start of the table. Returns 0 at the end of it.
+struct proc*
+procsweep(int *pid, int next)
+{
+  struct proc *p;
+  int h;
+
+  acquire(&proctab.lock);
+  h = *pid % NPIDHASH;
+  p = proctab.pid[h];
+  if(*pid != 0){
+    while(p && (p->pid > *pid || (next && p->pid == *pid)))
+      p = p->pidnext;
+  }
+  while(p == 0 && ++h < NPIDHASH)
+    p = proctab.pid[h];
+  if(p){
+    acquire(&p->lock);
+    *pid = p->pid;
+  }
+  release(&proctab.lock);
+  return p;
+}
+
 // Copy to either a user address, or kernel address,
 // depending on usr_dst.
 // Returns 0 on success, -1 on error.
@@ -641,16 +1209,19 @@ procdump(void)
   };
   struct proc *p;
   char *state;
+  int h;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
-    if(p->state == UNUSED)
-      continue;
-    if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
-      state = states[p->state];
-    else
-      state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
-    printf("\n");
+  for(h = 0; h < NPIDHASH; h++){
+    for(p = proctab.pid[h]; p; p = p->pidnext){
+      if(p->state == UNUSED)
+        continue;
+      if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
+        state = states[p->state];
+      else
+        state = "???";
+      printf("%d %s %s", p->pid, state, p->name);
+      printf("\n");
+    }
   }
 }
@@ -82,6 +82,21 @@ struct trapframe {
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A range of a process's address space whose pages are read
+// in from a file, or zero-filled, when first touched (see
+// vma.c): a program segment loaded by exec(), or an area
+// made by mmap(). Bytes past filesz are zero.
+struct vma {
+  uint64 start;                // First virtual address, page-aligned
+  uint64 end;                  // One past the last; 0 if the slot is free
+  int perm;                    // PTE_R, PTE_W and PTE_X for the pages
+  int flags;                   // MAP_SHARED or MAP_PRIVATE; 0 for a program segment
+  struct inode *ip;            // File the pages come from; 0 if anonymous
+  struct shm *shm;             // Shared-memory segment mapped here, or 0
+  uint off;                    // File offset of start
+  uint filesz;                 // Bytes of the area that are in the file
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -92,14 +107,44 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // CPU whose run queue p goes on when runnable
+  int prio;                    // Priority level, 0 (highest) to NPRIO-1
+  int nice;                    // Niceness, 0 to 19; keeps prio at or below prio0(p)
+  int ticks;                   // Ticks used at level prio
+  uint boostgen;               // Priority boost p's prio dates from
+
+  // the run queue's lock must be held when using this:
+  struct proc *rqnext;         // Next process on the run queue
+
+  // the wait queue's lock must be held when using these:
+  struct proc *wqnext;         // Next sleeper on the wait queue of chan
+  struct proc *wqprev;         // and the previous one
+
+  // the timer wheel's lock must be held when using these:
+  int timed;                   // On the timer wheel?
+  uint deadline;               // Tick at which sleeptimed() gives up
+  struct proc *tmnext;         // Next process in the same wheel slot
+  struct proc *tmprev;         // and the previous one
+
+  // proctab.lock must be held when using this:
+  struct proc *pidnext;        // Next process in the same pid hash chain
 
-  // wait_lock must be held when using this:
+  // wait_lock must be held when using these:
   struct proc *parent;         // Parent process
+  struct proc *child;          // First child
+  struct proc *sibnext;        // Next child of parent
+  struct proc *sibprev;        // and the previous one
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
+  uint64 ustack;               // Top of the user stack region; the heap starts here
   pagetable_t pagetable;       // User page table
+  pagetable_t kpagetable;      // Kernel page table, with user memory at UALIAS
+  int asid;                    // Address-space ID in satp (see kvmswitch())
+  uint64 asidgen;              // ASID generation asid belongs to; 0 if none
+  uint64 tlbstale;             // CPUs that must flush asid before running p
+  struct vma vma[NVMA];        // Program segments and mmap() areas
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
@@ -0,0 +1,211 @@
+//
+// Shared-memory segments.
+//
+// shm_create() allocates a segment of zeroed pages and
+// returns its id; shm_attach() maps the segment into the
+// calling process, and any other process that knows the id
+// may attach it too. Every process maps the same physical
+// pages, so data written by one is seen by the others
+// without being copied.
+//
+// An attachment is a MAP_SHARED area in p->vma with
+// v->shm set. Each mapping of a page holds a reference
+// to it (krefinc()), as does the segment itself. The
+// segment has a count of attachments, which fork() adds
+// to; it is freed, and its id forgotten, when the last
+// one is detached or its process exits. A new segment
+// starts out attached to its creator, so that it does
+// not vanish before anyone has attached it; shm_attach()
+// in a process that already has it attached just returns
+// the address.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fcntl.h"
+#include "defs.h"
+
+struct shm {
+  int id;                  // 0 if the slot is free
+  int ref;                 // attachments
+  int npages;
+  char **pages;            // one page of page pointers
+};
+
+struct {
+  struct spinlock lock;
+  struct shm shm[NSHM];
+  int nextid;
+} shmtab;
+
+void
+shminit(void)
+{
+  initlock(&shmtab.lock, "shm");
+  shmtab.nextid = 1;
+}
+
+// Free a segment's pages and page list.
+static void
+shmfree(char **pages, int npages)
+{
+  int i;
+
+  for(i = 0; i < npages; i++)
+    kfree(pages[i]);
+  kfree(pages);
+}
+
+// Add an attachment to s, for fork().
+void
+shmdup(struct shm *s)
+{
+  acquire(&shmtab.lock);
+  s->ref++;
+  release(&shmtab.lock);
+}
+
+// Drop an attachment to s, and free the segment if it
+// was the last one.
+void
+shmput(struct shm *s)
+{
+  char **pages = 0;
+  int npages = 0;
+
+  acquire(&shmtab.lock);
+  if(--s->ref == 0){
+    pages = s->pages;
+    npages = s->npages;
+    s->id = 0;
+    s->pages = 0;
+  }
+  release(&shmtab.lock);
+
+  if(pages)
+    shmfree(pages, npages);
+}
+
+// Map segment s into p, which does not have it attached.
+// Takes over a reference to s on success.
+// Returns the address, or -1.
+static uint64
+shmmap(struct proc *p, struct shm *s)
+{
+  struct vma *v;
+  uint64 va, len;
+  int i;
+
+  len = (uint64)s->npages * PGSIZE;
+  if((va = vmaplace(p->vma, len, PGROUNDUP(p->sz))) == 0 ||
+     (v = vmaalloc(p->vma)) == 0)
+    return -1;
+  for(i = 0; i < s->npages; i++){
+    if(mappages(p->pagetable, va + i*PGSIZE, PGSIZE, (uint64)s->pages[i],
+                PTE_R|PTE_W|PTE_U) != 0){
+      uvmunmap(p->pagetable, va, i, 1);
+      return -1;
+    }
+    krefinc(s->pages[i]);
+  }
+  v->start = va;
+  v->end = va + len;
+  v->perm = PTE_R|PTE_W;
+  v->flags = MAP_SHARED;
+  v->shm = s;
+  return va;
+}
+
+// Create a segment of size bytes, attached to the
+// current process. Returns its id, or -1.
+int
+shmcreate(int size)
+{
+  struct shm *s;
+  char **pages;
+  int i, npages;
+
+  npages = PGROUNDUP((uint64)size) / PGSIZE;
+  if(size <= 0 || npages > SHMMAXPG || npages > PGSIZE / sizeof(char*))
+    return -1;
+  if((pages = kalloc_zeroed()) == 0)
+    return -1;
+  for(i = 0; i < npages; i++){
+    if((pages[i] = swapkalloc(1)) == 0){
+      shmfree(pages, i);
+      return -1;
+    }
+  }
+
+  acquire(&shmtab.lock);
+  for(s = shmtab.shm; s < &shmtab.shm[NSHM]; s++)
+    if(s->id == 0)
+      break;
+  if(s == &shmtab.shm[NSHM]){
+    release(&shmtab.lock);
+    shmfree(pages, npages);
+    return -1;
+  }
+  s->id = shmtab.nextid++;
+  if(shmtab.nextid < 0)
+    shmtab.nextid = 1;
+  s->ref = 1;
+  s->npages = npages;
+  s->pages = pages;
+  release(&shmtab.lock);
+
+  if(shmmap(myproc(), s) == -1){
+    shmput(s);
+    return -1;
+  }
+  return s->id;
+}
+
+// Attach the segment id to the current process.
+// Returns its address, or -1 if there is no such segment
+// or no room for it.
+uint64
+shmattach(int id)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  struct shm *s;
+  uint64 va;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->end != 0 && v->shm && v->shm->id == id)
+      return v->start;
+
+  acquire(&shmtab.lock);
+  for(s = shmtab.shm; s < &shmtab.shm[NSHM]; s++)
+    if(id > 0 && s->id == id)
+      break;
+  if(s == &shmtab.shm[NSHM]){
+    release(&shmtab.lock);
+    return -1;
+  }
+  s->ref++;
+  release(&shmtab.lock);
+
+  if((va = shmmap(p, s)) == -1)
+    shmput(s);
+  return va;
+}
+
+// Detach the segment attached at va from the current
+// process. Returns 0, or -1 if there is none.
+int
+shmdetach(uint64 va)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->end != 0 && v->shm && v->start == va)
+      return vmaunmap(p->pagetable, p->vma, v->start, v->end);
+  return -1;
+}
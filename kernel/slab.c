@@ -0,0 +1,308 @@
+// Object caches for small, fixed-size kernel objects
+// (pipes, open files, in-memory inodes).
+//
+// A cache carves whole pages from kalloc() into slabs of
+// equal-sized objects. The struct slab header sits at the
+// start of its page, so the slab that owns an object is
+// found by rounding the object's address down to a page.
+//
+// Each CPU also keeps a small magazine of free objects per
+// cache. kmem_cache_alloc() and kmem_cache_free() normally
+// touch only the calling CPU's magazine; the cache's own
+// lock is taken only to move half a magazine of objects
+// to or from the slabs.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NCACHE  8   // maximum number of caches
+#define MAGSIZE 16  // objects per per-CPU magazine
+
+struct slab {
+  struct kmem_cache *cache;
+  struct slab *next;  // cache's list of slabs with free objects
+  struct slab *prev;
+  void *freelist;     // free objects in this slab
+  int inuse;          // number of objects handed out
+};
+
+#define SLABHDR ((sizeof(struct slab) + 15) & ~15)
+
+struct magazine {
+  struct spinlock lock;
+  int n;
+  void *obj[MAGSIZE];
+};
+
+struct kmem_cache {
+  char *name;
+  uint size;            // object size, rounded up
+  int perslab;          // objects per slab
+  struct spinlock lock; // protects the fields below
+  struct slab partial;  // head of list of slabs with a free object
+  int nempty;           // slabs on the list with no object in use
+  struct magazine mag[NCPU];
+};
+
+struct {
+  struct spinlock lock;
+  struct kmem_cache cache[NCACHE];
+  int n;
+} slabs;
+
+void
+slabinit(void)
+{
+  initlock(&slabs.lock, "slabs");
+}
+
+// Create a cache of objects of the given size.
+// Panics if there is no room for another cache.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+
+  size = (size + 7) & ~7;
+  if(size == 0 || size > PGSIZE - SLABHDR)
+    panic("kmem_cache_create: size");
+
+  acquire(&slabs.lock);
+  if(slabs.n >= NCACHE)
+    panic("kmem_cache_create: too many caches");
+  c = &slabs.cache[slabs.n];
+  c->name = name;
+  c->size = size;
+  c->perslab = (PGSIZE - SLABHDR) / size;
+  initlock(&c->lock, name);
+  c->partial.next = c->partial.prev = &c->partial;
+  c->nempty = 0;
+  for(int i = 0; i < NCPU; i++){
+    initlock(&c->mag[i].lock, "magazine");
+    c->mag[i].n = 0;
+  }
+  slabs.n++;
+  release(&slabs.lock);
+  return c;
+}
+
+static void
+slab_link(struct kmem_cache *c, struct slab *s)
+{
+  s->next = c->partial.next;
+  s->prev = &c->partial;
+  c->partial.next->prev = s;
+  c->partial.next = s;
+}
+
+static void
+slab_unlink(struct slab *s)
+{
+  s->prev->next = s->next;
+  s->next->prev = s->prev;
+}
+
+// Take up to n free objects out of c's slabs.
+// Returns the number taken.
+static int
+cache_take(struct kmem_cache *c, void **objs, int n)
+{
+  struct slab *s;
+  int got = 0;
+
+  acquire(&c->lock);
+  while(got < n && (s = c->partial.next) != &c->partial){
+    while(got < n && s->freelist){
+      objs[got++] = s->freelist;
+      s->freelist = *(void**)s->freelist;
+      if(s->inuse++ == 0)
+        c->nempty--;
+    }
+    if(s->freelist == 0)
+      slab_unlink(s); // full
+  }
+  release(&c->lock);
+  return got;
+}
+
+// Return n objects to their slabs. Slabs that become
+// empty are freed, except that the cache keeps one
+// around to absorb alloc/free cycles.
+static void
+cache_put(struct kmem_cache *c, void **objs, int n)
+{
+  struct slab *s, *dead;
+
+  dead = 0;
+  acquire(&c->lock);
+  for(int i = 0; i < n; i++){
+    s = (struct slab*)PGROUNDDOWN((uint64)objs[i]);
+    if(s->cache != c)
+      panic("kmem_cache_free: wrong cache");
+    if(s->freelist == 0)
+      slab_link(c, s); // was full
+    *(void**)objs[i] = s->freelist;
+    s->freelist = objs[i];
+    if(--s->inuse == 0){
+      if(c->nempty > 0){
+        slab_unlink(s);
+        s->next = dead;
+        dead = s;
+      } else {
+        c->nempty++;
+      }
+    }
+  }
+  release(&c->lock);
+
+  while(dead){
+    s = dead;
+    dead = s->next;
+    kfree(s);
+  }
+}
+
+// Turn a fresh page into a slab of free objects
+// and add it to c.
+static void
+cache_grow(struct kmem_cache *c, char *page)
+{
+  struct slab *s = (struct slab*)page;
+  char *obj;
+
+  s->cache = c;
+  s->inuse = 0;
+  s->freelist = 0;
+  for(int i = c->perslab - 1; i >= 0; i--){
+    obj = page + SLABHDR + i*c->size;
+    *(void**)obj = s->freelist;
+    s->freelist = obj;
+  }
+
+  acquire(&c->lock);
+  slab_link(c, s);
+  c->nempty++;
+  release(&c->lock);
+}
+
+// Allocate an object from cache c.
+// The object's contents are undefined.
+// Returns 0 if out of memory.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct magazine *m;
+  void *objs[MAGSIZE/2];
+  void *obj = 0;
+  char *page;
+  int n, i;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  acquire(&m->lock);
+  if(m->n > 0)
+    obj = m->obj[--m->n];
+  release(&m->lock);
+  pop_off();
+  if(obj)
+    return obj;
+
+  // Magazine is empty; refill it from the slabs.
+  // kalloc() is never called with a slab lock held,
+  // since kalloc() may reap the caches.
+  while((n = cache_take(c, objs, MAGSIZE/2)) == 0){
+    if((page = kalloc()) == 0)
+      return 0;
+    cache_grow(c, page);
+  }
+
+  push_off();
+  m = &c->mag[cpuid()];
+  acquire(&m->lock);
+  for(i = 1; i < n && m->n < MAGSIZE; i++)
+    m->obj[m->n++] = objs[i];
+  release(&m->lock);
+  pop_off();
+  if(i < n)
+    cache_put(c, objs + i, n - i);
+
+  return objs[0];
+}
+
+// Return an object to cache c.
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct magazine *m;
+  void *objs[MAGSIZE/2 + 1];
+  int n = 0;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  acquire(&m->lock);
+  if(m->n == MAGSIZE){
+    // Magazine is full; send half of it back to the slabs.
+    while(n < MAGSIZE/2)
+      objs[n++] = m->obj[--m->n];
+  }
+  m->obj[m->n++] = obj;
+  release(&m->lock);
+  pop_off();
+
+  if(n > 0)
+    cache_put(c, objs, n);
+}
+
+// Give every free object in every cache back to its slab
+// and free every empty slab. Called by kalloc() when it
+// runs out of memory. Returns the number of pages freed.
+int
+kmem_cache_reap(void)
+{
+  struct kmem_cache *c;
+  struct slab *s, *next, *dead;
+  void *objs[MAGSIZE];
+  int i, n, nc, freed;
+
+  acquire(&slabs.lock);
+  nc = slabs.n;
+  release(&slabs.lock);
+
+  freed = 0;
+  for(c = slabs.cache; c < &slabs.cache[nc]; c++){
+    for(i = 0; i < NCPU; i++){
+      acquire(&c->mag[i].lock);
+      n = c->mag[i].n;
+      memmove(objs, c->mag[i].obj, n * sizeof(void*));
+      c->mag[i].n = 0;
+      release(&c->mag[i].lock);
+      if(n > 0)
+        cache_put(c, objs, n);
+    }
+
+    dead = 0;
+    acquire(&c->lock);
+    for(s = c->partial.next; s != &c->partial; s = next){
+      next = s->next;
+      if(s->inuse == 0){
+        slab_unlink(s);
+        s->next = dead;
+        dead = s;
+      }
+    }
+    c->nempty = 0;
+    release(&c->lock);
+
+    while(dead){
+      s = dead;
+      dead = s->next;
+      kfree(s);
+      freed++;
+    }
+  }
+  return freed;
+}
@@ -8,12 +8,54 @@
 #include "proc.h"
 #include "defs.h"
 
+#ifdef LAB_LOCK
+// room for every process's lock, as well as the rest.
+#define NLOCK (NPROC + 500)
+
+// every initialized lock, so that statslock()
+// can report contention.
+static struct spinlock *locks[NLOCK];
+struct spinlock lock_locks;
+
+void
+freelock(struct spinlock *lk)
+{
+  acquire(&lock_locks);
+  for(int i = 0; i < NLOCK; i++){
+    if(locks[i] == lk){
+      locks[i] = 0;
+      break;
+    }
+  }
+  release(&lock_locks);
+}
+
+static void
+findslot(struct spinlock *lk)
+{
+  acquire(&lock_locks);
+  for(int i = 0; i < NLOCK; i++){
+    if(locks[i] == 0){
+      locks[i] = lk;
+      release(&lock_locks);
+      return;
+    }
+  }
+  panic("findslot");
+}
+#endif
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+#ifdef LAB_LOCK
+  lk->nts = 0;
+  lk->n = 0;
+  findslot(lk);
+#endif
 }
 
 // Acquire the lock.
@@ -29,8 +71,14 @@ acquire(struct spinlock *lk)
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+#ifdef LAB_LOCK
+  __sync_fetch_and_add(&lk->n, 1);
+#endif
+  while(__sync_lock_test_and_set(&lk->locked, 1) != 0){
+#ifdef LAB_LOCK
+    __sync_fetch_and_add(&lk->nts, 1);
+#endif
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -108,3 +156,72 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+// Can the current thread sleep? Not while it
+// holds a spinlock.
+int
+cansleep(void)
+{
+  int n;
+
+  push_off();
+  n = mycpu()->noff;
+  pop_off();
+  return n == 1;
+}
+
+#ifdef LAB_LOCK
+static int
+snprint_lock(char *buf, int sz, struct spinlock *lk)
+{
+  int n = 0;
+  if(lk->n > 0){
+    n = snprintf(buf, sz, "lock: %s: #test-and-set %d #acquire() %d\n",
+                 lk->name, lk->nts, lk->n);
+  }
+  return n;
+}
+
+// Format contention counts for the kmem and bcache locks,
+// followed by the five most contended locks, into buf.
+// The last line is "tot= N", the total test-and-set spins
+// on kmem and bcache locks.
+int
+statslock(char *buf, int sz)
+{
+  int n;
+  int tot = 0;
+
+  acquire(&lock_locks);
+  n = snprintf(buf, sz, "--- lock kmem/bcache stats\n");
+  for(int i = 0; i < NLOCK; i++){
+    if(locks[i] == 0)
+      continue;
+    if(strncmp(locks[i]->name, "bcache", strlen("bcache")) == 0 ||
+       strncmp(locks[i]->name, "kmem", strlen("kmem")) == 0){
+      tot += locks[i]->nts;
+      n += snprint_lock(buf+n, sz-n, locks[i]);
+    }
+  }
+
+  n += snprintf(buf+n, sz-n, "--- top 5 contended locks:\n");
+  int last = 100000000;
+  // simple selection of the top 5 contended locks.
+  for(int t = 0; t < 5; t++){
+    struct spinlock *top = 0;
+    for(int i = 0; i < NLOCK; i++){
+      if(locks[i] == 0)
+        continue;
+      if(locks[i]->nts < last && (top == 0 || locks[i]->nts > top->nts))
+        top = locks[i];
+    }
+    if(top == 0)
+      break;
+    n += snprint_lock(buf+n, sz-n, top);
+    last = top->nts;
+  }
+  n += snprintf(buf+n, sz-n, "tot= %d\n", tot);
+  release(&lock_locks);
+  return n;
+}
+#endif
@@ -5,5 +5,9 @@ struct spinlock {
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+#ifdef LAB_LOCK
+  int nts;           // Number of spins waiting for the lock.
+  int n;             // Number of acquire() calls.
+#endif
 };
 
@@ -16,10 +16,16 @@ uint64 timer_scratch[NCPU][5];
 // assembly code in kernelvec.S for machine-mode timer interrupt.
 extern void timervec();
 
+// physical address of the device tree blob, for fdt.c.
+uint64 dtbpa;
+
 // entry.S jumps here in machine mode on stack0.
 void
-start()
+start(uint64 dtb)
 {
+  if(r_mhartid() == 0)
+    dtbpa = dtb;
+
   // set M Previous Privilege mode to Supervisor, for mret.
   unsigned long x = r_mstatus();
   x &= ~MSTATUS_MPP_MASK;
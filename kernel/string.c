@@ -1,13 +1,42 @@
 #include "types.h"
 
+// memset(), memmove(), memcmp() and strlen() work a 64-bit
+// word at a time where the alignment of their arguments
+// allows, and a byte at a time at the ends.
+
+// a word that may alias memory of any other type.
+typedef uint64 __attribute__((may_alias)) word;
+
+#define WSZ ((int)sizeof(word))
+#define ONES  0x0101010101010101UL
+#define HIGHS 0x8080808080808080UL
+
+// Does word w have a zero byte?
+#define HASZERO(w) (((w) - ONES) & ~(w) & HIGHS)
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  word *wdst, w;
+
+  while(n > 0 && ((uint64)cdst & (WSZ-1))){
+    *cdst++ = c;
+    n--;
   }
+  wdst = (word *) cdst;
+  w = (uchar)c * ONES;
+  for(; n >= 4*WSZ; n -= 4*WSZ, wdst += 4){
+    wdst[0] = w;
+    wdst[1] = w;
+    wdst[2] = w;
+    wdst[3] = w;
+  }
+  for(; n >= WSZ; n -= WSZ)
+    *wdst++ = w;
+  cdst = (char *) wdst;
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -18,6 +47,14 @@ memcmp(const void *v1, const void *v2, uint n)
 
   s1 = v1;
   s2 = v2;
+  if((((uint64)s1 ^ (uint64)s2) & (WSZ-1)) == 0){
+    while(n > 0 && ((uint64)s1 & (WSZ-1)) && *s1 == *s2)
+      n--, s1++, s2++;
+    // skip equal words; the bytes find the difference.
+    if(((uint64)s1 & (WSZ-1)) == 0)
+      for(; n >= WSZ && *(word*)s1 == *(word*)s2; n -= WSZ)
+        s1 += WSZ, s2 += WSZ;
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -32,20 +69,52 @@ memmove(void *dst, const void *src, uint n)
 {
   const char *s;
   char *d;
+  int aligned;
 
   if(n == 0)
     return dst;
   
   s = src;
   d = dst;
+  aligned = (((uint64)s ^ (uint64)d) & (WSZ-1)) == 0;
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if(aligned){
+      for(; n > 0 && ((uint64)d & (WSZ-1)); n--)
+        *--d = *--s;
+      for(; n >= 4*WSZ; n -= 4*WSZ){
+        d -= 4*WSZ;
+        s -= 4*WSZ;
+        ((word*)d)[3] = ((word*)s)[3];
+        ((word*)d)[2] = ((word*)s)[2];
+        ((word*)d)[1] = ((word*)s)[1];
+        ((word*)d)[0] = ((word*)s)[0];
+      }
+      for(; n >= WSZ; n -= WSZ){
+        d -= WSZ;
+        s -= WSZ;
+        *(word*)d = *(word*)s;
+      }
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if(aligned){
+      for(; n > 0 && ((uint64)d & (WSZ-1)); n--)
+        *d++ = *s++;
+      for(; n >= 4*WSZ; n -= 4*WSZ, d += 4*WSZ, s += 4*WSZ){
+        ((word*)d)[0] = ((word*)s)[0];
+        ((word*)d)[1] = ((word*)s)[1];
+        ((word*)d)[2] = ((word*)s)[2];
+        ((word*)d)[3] = ((word*)s)[3];
+      }
+      for(; n >= WSZ; n -= WSZ, d += WSZ, s += WSZ)
+        *(word*)d = *(word*)s;
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
@@ -95,13 +164,21 @@ safestrcpy(char *s, const char *t, int n)
   return os;
 }
 
+// Reading whole aligned words may look past the '\0', but
+// never past the end of its page.
 int
 strlen(const char *s)
 {
-  int n;
+  const char *p = s;
+  const word *w;
 
-  for(n = 0; s[n]; n++)
+  for(; (uint64)p & (WSZ-1); p++)
+    if(*p == 0)
+      return p - s;
+  for(w = (const word *) p; !HASZERO(*w); w++)
+    ;
+  for(p = (const char *) w; *p; p++)
     ;
-  return n;
+  return p - s;
 }
 
@@ -0,0 +1,279 @@
+//
+// Swapping user pages to disk.
+//
+// mkfs reserves a swap area of NSWAP blocks after the file
+// system; the superblock says where it is. The area is
+// divided into page-sized slots.
+//
+// When a fault needs a page and there is no free memory,
+// swapout() picks pages to evict with a clock sweep over
+// every process's user memory: a page whose accessed bit
+// (PTE_A) is set gets a second chance and has the bit
+// cleared. An evicted page is written to a free slot, and
+// its PTE is left with PTE_V clear, PTE_SWAP set, the slot
+// number where the physical page number was, and the
+// permission bits intact. uvmfault() calls swapin() to read
+// it back when the process touches it again.
+//
+// Only private 4KB pages are evicted: not copy-on-write or
+// cached program pages, whose reference counts are above
+// one, and not megapages. A process's pages are evicted
+// only while it sleeps (or by the process itself), since
+// there is no way to flush another running CPU's TLB (a
+// sleeping process flushes when it next runs; see
+// tlbinval()) and a process preempted inside
+// the kernel may be in the middle of copying to or from a
+// page.
+//
+// A slot has a reference count, so that fork() can share it
+// between parent and child, and a busy flag, set while the
+// page is being written, which swapin() waits for. The
+// counts are updated with atomic instructions, since fork()
+// copies PTEs with the child's p->lock held.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "buf.h"
+#include "defs.h"
+
+#define NSLOT (NSWAP / (PGSIZE / BSIZE))
+#define SWAPBATCH 8  // pages swapout() evicts when a fault runs out
+
+struct {
+  int dev;
+  uint start;              // first block of the swap area
+  int nslot;               // 0 if there is no swap area
+  int ref[NSLOT];          // PTEs (and writers) using each slot
+
+  struct spinlock lock;    // protects busy[]
+  uchar busy[NSLOT];       // being written?
+
+  // one swapout() at a time; protects the clock hand.
+  struct sleeplock evict;
+  int hand;                // pid of the process at the clock hand
+  uint64 va;               // and the next address it looks at
+
+  // one block transfer at a time, through buf.
+  struct sleeplock io;
+  struct buf buf;
+} swap;
+
+// Set up the swap area described by the superblock of dev.
+void
+swapinit(int dev, uint start, uint nblocks)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.evict, "swapevict");
+  initsleeplock(&swap.io, "swapio");
+  swap.dev = dev;
+  swap.start = start;
+  swap.nslot = nblocks / (PGSIZE / BSIZE);
+  if(swap.nslot > NSLOT)
+    swap.nslot = NSLOT;
+}
+
+// Move a page between memory and swap slot.
+static void
+swaprw(int slot, char *pa, int write)
+{
+  int i;
+
+  acquiresleep(&swap.io);
+  swap.buf.dev = swap.dev;
+  for(i = 0; i < PGSIZE / BSIZE; i++){
+    swap.buf.blockno = swap.start + slot * (PGSIZE / BSIZE) + i;
+    if(write)
+      memmove(swap.buf.data, pa + i*BSIZE, BSIZE);
+    virtio_disk_rw(&swap.buf, write);
+    if(!write)
+      memmove(pa + i*BSIZE, swap.buf.data, BSIZE);
+  }
+  releasesleep(&swap.io);
+}
+
+// Allocate a slot, with one reference for the PTE that
+// will record it and one for its writer, and mark it busy.
+// Returns -1 if swap is full.
+static int
+slotalloc(void)
+{
+  int i;
+
+  for(i = 0; i < swap.nslot; i++){
+    if(__sync_bool_compare_and_swap(&swap.ref[i], 0, 2)){
+      swap.busy[i] = 1;
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Add a reference to a slot, for a PTE copied by fork().
+void
+swapdup(int slot)
+{
+  __sync_fetch_and_add(&swap.ref[slot], 1);
+}
+
+// Drop a reference to a slot.
+void
+swapfree(int slot)
+{
+  if(__sync_sub_and_fetch(&swap.ref[slot], 1) < 0)
+    panic("swapfree");
+}
+
+// The page for slot is on disk.
+static void
+slotdone(int slot)
+{
+  acquire(&swap.lock);
+  swap.busy[slot] = 0;
+  wakeup(&swap.busy[slot]);
+  release(&swap.lock);
+  swapfree(slot);
+}
+
+// Look for a page of p to evict, continuing the clock sweep
+// from *va. Caller holds p->lock.
+static pte_t*
+victim(struct proc *p, uint64 *va)
+{
+  pte_t *pte;
+
+  for(; *va < p->sz; *va += PGSIZE){
+    pte = walk(p->pagetable, *va, 0);
+    if(pte == 0 || (*pte & (PTE_V|PTE_MEGA)) == (PTE_V|PTE_MEGA)){
+      // no page table, or a megapage: skip the 2MB.
+      *va = MEGAPGROUNDDOWN(*va) + MEGAPGSIZE - PGSIZE;
+      continue;
+    }
+    if((*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U) || (*pte & PTE_COW))
+      continue;
+    if(krefcnt((void*)PTE2PA(*pte)) != 1)
+      continue;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      continue;
+    }
+    return pte;
+  }
+  return 0;
+}
+
+// Evict one page. Caller holds swap.evict.
+// Returns 0 on success, -1 if no page could be evicted.
+static int
+evict(void)
+{
+  struct proc *p;
+  pte_t *pte;
+  uint64 pa;
+  int pid, wraps, next, slot;
+
+  if((slot = slotalloc()) < 0)
+    return -1;
+
+  // two full turns of the clock, besides the rest of the
+  // one it is in: the first may only clear accessed bits.
+  next = 0;
+  for(wraps = 0; wraps < 3; ){
+    pid = swap.hand;
+    if((p = procsweep(&swap.hand, next)) == 0){
+      swap.hand = 0;
+      swap.va = 0;
+      next = 0;
+      wraps++;
+      continue;
+    }
+    if(p->pid != pid)
+      swap.va = 0;
+    if(p->pagetable != 0 && (p->state == SLEEPING || p == myproc()) &&
+       (pte = victim(p, &swap.va)) != 0){
+      pa = PTE2PA(*pte);
+      *pte = SLOT2PTE(slot) | (PTE_FLAGS(*pte) & ~(PTE_V|PTE_A|PTE_D)) | PTE_SWAP;
+      tlbinval(p, swap.va, 1);
+      swap.va += PGSIZE;
+      release(&p->lock);
+
+      swaprw(slot, (char*)pa, 1);
+      kfree((void*)pa);
+      slotdone(slot);
+      return 0;
+    }
+    release(&p->lock);
+    swap.va = 0;
+    next = 1;
+  }
+
+  // nothing to evict; give the slot back.
+  swap.busy[slot] = 0;
+  swapfree(slot);
+  swapfree(slot);
+  return -1;
+}
+
+// Evict up to n pages to swap, to make room in memory.
+// Returns the number of pages evicted.
+int
+swapout(int n)
+{
+  int i;
+
+  if(swap.nslot == 0 || !cansleep())
+    return 0;
+  acquiresleep(&swap.evict);
+  for(i = 0; i < n; i++)
+    if(evict() < 0)
+      break;
+  releasesleep(&swap.evict);
+  return i;
+}
+
+// Allocate a page for user memory: like kalloc() (or
+// kalloc_zeroed() if zero is set), but if memory has run
+// out, swap pages out to make room.
+void*
+swapkalloc(int zero)
+{
+  void *mem;
+
+  for(;;){
+    mem = zero ? kalloc_zeroed() : kalloc();
+    if(mem != 0 || swapout(SWAPBATCH) == 0)
+      return mem;
+  }
+}
+
+// Read the swapped-out page that *pte records back into
+// memory and map it at va again.
+// Returns 0 on success, -1 if there is no memory.
+int
+swapin(pagetable_t pagetable, uint64 va, pte_t *pte)
+{
+  int slot;
+  char *mem;
+
+  if(!cansleep())
+    return -1;
+  slot = PTE2SLOT(*pte);
+  if((mem = swapkalloc(0)) == 0)
+    return -1;
+
+  acquire(&swap.lock);
+  while(swap.busy[slot])
+    sleep(&swap.busy[slot], &swap.lock);
+  release(&swap.lock);
+
+  swaprw(slot, mem, 0);
+  *pte = PA2PTE(mem) | (PTE_FLAGS(*pte) & ~PTE_SWAP) | PTE_V;
+  swapfree(slot);
+  return 0;
+}
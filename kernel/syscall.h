@@ -20,3 +20,10 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_mmap   22
+#define SYS_munmap 23
+#define SYS_shm_create 24
+#define SYS_shm_attach 25
+#define SYS_shm_detach 26
+#define SYS_spawn  27
+#define SYS_nice   28
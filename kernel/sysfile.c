@@ -258,8 +258,10 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
-    panic("create: ialloc");
+  if((ip = ialloc(dp->dev, type)) == 0){
+    iunlockput(dp);
+    return 0;
+  }
 
   ilock(ip);
   ip->major = major;
@@ -268,19 +270,32 @@ create(char *path, short type, short major, short minor)
   iupdate(ip);
 
   if(type == T_DIR){  // Create . and .. entries.
-    dp->nlink++;  // for ".."
-    iupdate(dp);
     // No ip->nlink++ for ".": avoid cyclic ref count.
     if(dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", dp->inum) < 0)
       panic("create dots");
   }
 
+  // the name can be there after all if dirlookup() above
+  // ran out of memory for its inode.
   if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
+    goto fail;
+
+  if(type == T_DIR){
+    dp->nlink++;  // for ".."
+    iupdate(dp);
+  }
 
   iunlockput(dp);
 
   return ip;
+
+ fail:
+  // de-allocate ip.
+  ip->nlink = 0;
+  iupdate(ip);
+  iunlockput(ip);
+  iunlockput(dp);
+  return 0;
 }
 
 uint64
@@ -412,19 +427,18 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+// Copy the user argument vector at uargv into argv,
+// which has MAXARG entries, one kalloc()ed page per string.
+// Returns 0, or -1 with argv freed.
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
+    if(i >= MAXARG){
       goto bad;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
@@ -440,18 +454,71 @@ sys_exec(void)
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
       goto bad;
   }
+  return 0;
 
-  int ret = exec(path, argv);
+ bad:
+  for(i = 0; i < MAXARG && argv[i] != 0; i++)
+    kfree(argv[i]);
+  return -1;
+}
+
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  int i;
+  uint64 uargv;
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+
+  int ret = exec(myproc(), path, argv);
 
   for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
     kfree(argv[i]);
 
   return ret;
+}
+
+// spawn(path, argv, fds): start path in a new process.
+// fds, if not 0, points to the three descriptors to give
+// it as 0, 1 and 2 (-1 for closed).
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  int i, fd[3];
+  uint64 uargv, ufds;
+  struct file *fds[3];
+  struct proc *p = myproc();
+
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0 ||
+     argaddr(2, &ufds) < 0){
+    return -1;
+  }
+  if(ufds){
+    if(copyin(p->pagetable, (char*)fd, ufds, sizeof(fd)) < 0)
+      return -1;
+    for(i = 0; i < 3; i++){
+      fds[i] = 0;
+      if(fd[i] < 0)
+        continue;
+      if(fd[i] >= NOFILE || (fds[i] = p->ofile[fd[i]]) == 0)
+        return -1;
+    }
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+
+  int ret = spawn(path, argv, ufds ? fds : 0);
 
- bad:
   for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
     kfree(argv[i]);
-  return -1;
+
+  return ret;
 }
 
 uint64
@@ -484,3 +551,68 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// Map length bytes of the file open as fd, starting at
+// offset, or zeroes if flags has MAP_ANONYMOUS, somewhere
+// in the address space. addr is only a hint and is ignored.
+// Returns the address of the mapping, or -1.
+uint64
+sys_mmap(void)
+{
+  uint64 addr, va, sz;
+  int len, prot, flags, off, perm;
+  struct file *f = 0;
+  struct proc *p = myproc();
+  struct vma *v;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(5, &off) < 0)
+    return -1;
+  if(len <= 0 || off < 0 || off % PGSIZE != 0)
+    return -1;
+  if((flags & (MAP_SHARED|MAP_PRIVATE)) == 0 ||
+     (flags & (MAP_SHARED|MAP_PRIVATE)) == (MAP_SHARED|MAP_PRIVATE))
+    return -1;
+  if((flags & MAP_ANONYMOUS) == 0){
+    if(argfd(4, 0, &f) < 0 || f->type != FD_INODE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+  }
+
+  // RISC-V has no write-only pages.
+  perm = 0;
+  if(prot & (PROT_READ|PROT_WRITE))
+    perm |= PTE_R;
+  if(prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(prot & PROT_EXEC)
+    perm |= PTE_X;
+
+  sz = PGROUNDUP((uint64)len);
+  if((va = vmaplace(p->vma, sz, PGROUNDUP(p->sz))) == 0 ||
+     (v = vmaalloc(p->vma)) == 0)
+    return -1;
+  v->start = va;
+  v->end = va + sz;
+  v->perm = perm;
+  v->flags = flags & (MAP_SHARED|MAP_PRIVATE);
+  v->ip = f ? idup(f->ip) : 0;
+  v->off = off;
+  v->filesz = f ? sz : 0;
+  return va;
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr;
+  int len;
+  struct proc *p = myproc();
+
+  if(argaddr(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  if(addr % PGSIZE != 0 || len <= 0 || addr + len > MAXVA)
+    return -1;
+  return vmaunmap(p->pagetable, p->vma, addr, PGROUNDUP(addr + len));
+}
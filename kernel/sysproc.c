@@ -67,7 +67,9 @@ sys_sleep(void)
       release(&tickslock);
       return -1;
     }
-    sleep(&ticks, &tickslock); // this sleep is kernel functions, not the sleep system call in user/usys.S.
+    // nothing calls wakeup(&ticks); the timer wheel
+    // wakes the process when its n ticks are up.
+    sleeptimed(&ticks, &tickslock, ticks0 + n - ticks); // this sleep is kernel functions, not the sleep system call in user/usys.S.
   }
   release(&tickslock);
   return 0;
@@ -95,3 +97,45 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// make the process nicer (lower priority) by inc;
+// returns the new nice value.
+uint64
+sys_nice(void)
+{
+  int inc;
+
+  if(argint(0, &inc) < 0)
+    return -1;
+  return nice(inc);
+}
+
+uint64
+sys_shm_create(void)
+{
+  int size;
+
+  if(argint(0, &size) < 0)
+    return -1;
+  return shmcreate(size);
+}
+
+uint64
+sys_shm_attach(void)
+{
+  int id;
+
+  if(argint(0, &id) < 0)
+    return -1;
+  return shmattach(id);
+}
+
+uint64
+sys_shm_detach(void)
+{
+  uint64 addr;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  return shmdetach(addr);
+}
@@ -11,6 +11,9 @@ uint ticks;
 
 extern char trampoline[], uservec[], userret[];
 
+// in uaccess.S.
+extern char copyuserend[], copyuserfault[];
+
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
 
@@ -65,6 +68,9 @@ usertrap(void)
     intr_on();
 
     syscall();
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            uvmfault(p->pagetable, r_stval(), r_scause() == 15) == 0){
+    // page fault on a lazily-allocated or copy-on-write page.
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
@@ -76,8 +82,9 @@ usertrap(void)
   if(p->killed)
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
+  // give up the CPU if this is a timer interrupt and p
+  // has had its share of it.
+  if(which_dev == 2 && schedtick())
     yield();
 
   usertrapret();
@@ -113,13 +120,15 @@ usertrapret(void)
   unsigned long x = r_sstatus();
   x &= ~SSTATUS_SPP; // clear SPP to 0 for user mode
   x |= SSTATUS_SPIE; // enable interrupts in user mode
+  x &= ~SSTATUS_SUM; // a copy preempted on this CPU may have left it set
   w_sstatus(x);
 
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // tell trampoline.S the user page table to switch to,
+  // and with which ASID.
+  uint64 satp = uvmsatp(p);
 
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
@@ -144,13 +153,22 @@ kerneltrap()
     panic("kerneltrap: interrupts enabled");
 
   if((which_dev = devintr()) == 0){
-    printf("scause %p\n", scause);
-    printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
-    panic("kerneltrap");
+    if((scause == 13 || scause == 15) && r_stval() >= UALIAS &&
+       sepc >= (uint64)copyuser && sepc < (uint64)copyuserend){
+      // a page fault in copyin() or copyout()'s direct
+      // copy of user memory.
+      if(copyfault(r_stval(), scause == 15, (sstatus & SSTATUS_SPIE) != 0) < 0)
+        sepc = (uint64)copyuserfault;
+    } else {
+      printf("scause %p\n", scause);
+      printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
+      panic("kerneltrap");
+    }
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
+  // give up the CPU if this is a timer interrupt and the
+  // process has had its share of it.
+  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING && schedtick())
     yield();
 
   // the yield() may have caused some traps to occur,
@@ -162,10 +180,15 @@ kerneltrap()
 void
 clockintr()
 {
+  uint now;
+
   acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
+  now = ++ticks;
   release(&tickslock);
+
+  timertick(now);
+  if(now % BOOSTTICKS == 0)
+    runqboost();
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -3,6 +3,8 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -15,6 +17,13 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// a page of zeroes, shared copy-on-write by every mapping
+// of a page that has been read but never written: untouched
+// heap, stack and bss pages, and private anonymous mmap()
+// pages. the kernel keeps a reference, so it is never
+// freed, and uvmcow() never hands it to a writer.
+static char *zeropage;
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
@@ -37,23 +46,66 @@ kvmmake(void)
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
   // map kernel data and the physical RAM we'll make use of.
-  kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
+  // past the first 2MB, mappages() uses megapages.
+  kvmmap(kpgtbl, (uint64)etext, (uint64)etext, phystop-(uint64)etext, PTE_R | PTE_W);
 
   // map the trampoline for trap entry/exit to
   // the highest virtual address in the kernel.
   kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
 
-  // map kernel stacks
-  proc_mapstacks(kpgtbl);
-  
+  // page-table pages for the kernel stack slots, which
+  // kstackmap() fills in as processes are created.
+  for(int i = 0; i < NPROC; i++)
+    if(walk(kpgtbl, KSTACK(i), 1) == 0)
+      panic("kvmmake: kstack");
+
   return kpgtbl;
 }
 
+// Map the page pa as the kernel stack at va, a KSTACK()
+// slot. The slot's page-table pages were made by kvmmake()
+// and are never freed, and every process's kernel page
+// table shares them, so this only sets a leaf PTE.
+void
+kstackmap(uint64 va, uint64 pa)
+{
+  pte_t *pte = walk(kernel_pagetable, va, 0);
+
+  if(pte == 0 || (*pte & PTE_V))
+    panic("kstackmap");
+  *pte = PA2PTE(pa) | PTE_R | PTE_W | PTE_V;
+}
+
+// Unmap the kernel stack at va, whose process has been
+// freed, and return its page for the caller to free.
+//
+// No CPU flushes its TLB for this. Nothing uses va until
+// kstackmap() gives the slot to a new process, and every
+// CPU flushes that process's ASIDs before it first runs it
+// there (see kvmswitch()), or flushes on every switch if
+// there are no ASIDs. A stale entry for va under another
+// process's ASID is never used, since no process touches
+// another's kernel stack.
+uint64
+kstackunmap(uint64 va)
+{
+  pte_t *pte = walk(kernel_pagetable, va, 0);
+  uint64 pa;
+
+  if(pte == 0 || (*pte & PTE_V) == 0)
+    panic("kstackunmap");
+  pa = PTE2PA(*pte);
+  *pte = 0;
+  return pa;
+}
+
 // Initialize the one kernel_pagetable
 void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  if((zeropage = kalloc_zeroed()) == 0)
+    panic("kvminit: zero page");
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -65,9 +117,208 @@ kvminithart()
   sfence_vma();
 }
 
+// Per-process kernel page tables.
+//
+// A process runs in the kernel on its own copy of the root
+// of kernel_pagetable, p->kpagetable, whose lower half is
+// the kernel's and whose upper half aliases the lower half
+// of the process's user page table: root entry 256+i of the
+// kernel page table is root entry i of the user one, so
+// the user's level-1 and level-0 page-table pages are shared
+// and user address va appears at UALIAS + va. copyin() and
+// copyout() copy through that alias with sstatus.SUM set,
+// and so never walk the page table; a page fault in the
+// copy goes to copyfault().
+//
+// The alias entries are filled in lazily, by copyfault(),
+// when a copy touches a root entry the user page table has
+// but the kernel one does not yet. kvmreset() empties them
+// when exec() frees the old user page table.
+
+// Make a kernel page table for a new process.
+pagetable_t
+kvmcreate(void)
+{
+  pagetable_t kpt;
+
+  if((kpt = (pagetable_t) kalloc_zeroed()) == 0)
+    return 0;
+  memmove(kpt, kernel_pagetable, (PGSIZE/sizeof(pte_t)) / 2 * sizeof(pte_t));
+  return kpt;
+}
+
+// Copy the user root entry for va into p's kernel page
+// table. Returns 1 if that changed it, 0 if not.
+static int
+kvmsync(struct proc *p, uint64 va)
+{
+  pte_t *upte = &p->pagetable[PX(2, va)];
+  pte_t *kpte = &p->kpagetable[PX(2, UALIAS + va)];
+
+  if(*kpte == *upte)
+    return 0;
+  *kpte = *upte;
+  return 1;
+}
+
+// Drop the alias of p's user memory, whose page table is
+// about to be freed.
+void
+kvmreset(struct proc *p)
+{
+  memset(&p->kpagetable[PX(2, UALIAS)], 0, (PGSIZE/sizeof(pte_t)) / 2 * sizeof(pte_t));
+}
+
+// Address-space identifiers.
+//
+// Each process runs with ASIDs in satp, one for its user
+// page table and one for its kernel page table, so that
+// the TLB can hold the entries of several address spaces at
+// once and switching between processes need not flush it.
+// The hardware's ASIDs are split in two: processes get user
+// ASIDs from 1 up to asids.max, handed out in order, and
+// use kasid() of that for their kernel page table;
+// kernel_pagetable itself, which the scheduler runs on,
+// uses ASID 0. When the ASIDs run out, a new generation
+// starts and every process gets fresh ones the next time
+// it is switched to.
+//
+// A CPU must flush a process's ASIDs before running it if
+// the process's page table has lost mappings or
+// permissions since the CPU last did, or if the ASIDs were
+// just handed to it (a CPU may hold entries from their last
+// owner). p->tlbstale has a bit for each CPU that must;
+// the scheduler checks it, through kvmswitch(). Processes
+// are single-threaded and their page tables only change
+// while they are not running, or by themselves, so the
+// flush need not happen any sooner.
+struct {
+  struct spinlock lock;
+  uint64 max;    // largest user ASID; 0 if there are none
+  uint64 gen;    // current generation
+  uint64 next;   // next ASID to hand out in it
+} asids;
+
+// Find out how many ASID bits satp has. Called once,
+// on the first hart, after kvminithart().
+void
+asidinit(void)
+{
+  initlock(&asids.lock, "asid");
+  w_satp(MAKE_SATP(kernel_pagetable) | SATP_ASID_MASK);
+  asids.max = ((r_satp() & SATP_ASID_MASK) >> SATP_ASID_SHIFT) / 2;
+  w_satp(MAKE_SATP(kernel_pagetable));
+  sfence_vma();
+  asids.gen = 1;
+  asids.next = 1;
+}
+
+// The ASID of p's kernel page table.
+static uint64
+kasid(struct proc *p)
+{
+  if(asids.max == 0)
+    return 0;
+  return p->asid + asids.max + 1;
+}
+
+// Switch this CPU to p's kernel page table, giving p ASIDs
+// if it has none in the current generation and flushing its
+// stale TLB entries here, or back to kernel_pagetable if p
+// is 0. Called by the scheduler with interrupts off.
+void
+kvmswitch(struct proc *p)
+{
+  uint64 cpu = 1L << cpuid();
+
+  if(p == 0){
+    w_satp(MAKE_SATP(kernel_pagetable));
+    return;
+  }
+
+  if(asids.max == 0){
+    // everything runs as ASID 0, and trampoline.S
+    // flushes the whole TLB on every switch too.
+    w_satp(MAKE_SATP(p->kpagetable));
+    sfence_vma();
+    return;
+  }
+
+  if(p->asidgen != asids.gen){
+    acquire(&asids.lock);
+    if(asids.next > asids.max){
+      asids.gen++;
+      asids.next = 1;
+    }
+    p->asid = asids.next++;
+    p->asidgen = asids.gen;
+    p->tlbstale = ~0L;
+    release(&asids.lock);
+  }
+  if(p->tlbstale & cpu){
+    __sync_fetch_and_and(&p->tlbstale, ~cpu);
+    sfence_vma_asid(p->asid);
+    sfence_vma_asid(kasid(p));
+  }
+  w_satp(MAKE_SATP(p->kpagetable) | (kasid(p) << SATP_ASID_SHIFT));
+}
+
+// Return the satp value for running p in user space.
+// Called by usertrapret().
+uint64
+uvmsatp(struct proc *p)
+{
+  return MAKE_SATP(p->pagetable) | ((uint64)p->asid << SATP_ASID_SHIFT);
+}
+
+// Some of p's mappings in [va, va + npages*PGSIZE) have
+// been removed or lost permissions. If p is the current
+// process, flush them, and their alias in p's kernel page
+// table, from this CPU's TLB now, page by page if there are
+// few, and have every other CPU flush p's ASIDs before
+// running it again; if not, have every CPU.
+void
+tlbinval(struct proc *p, uint64 va, uint64 npages)
+{
+  uint64 a;
+
+  push_off();
+  if(p != myproc()){
+    __sync_fetch_and_or(&p->tlbstale, ~0L);
+  } else {
+    __sync_fetch_and_or(&p->tlbstale, ~(1L << cpuid()));
+    if(npages <= 32){
+      for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
+        sfence_vma_page(a, p->asid);
+        sfence_vma_page(UALIAS + a, kasid(p));
+      }
+    } else if(asids.max == 0){
+      sfence_vma();
+    } else {
+      sfence_vma_asid(p->asid);
+      sfence_vma_asid(kasid(p));
+    }
+  }
+  pop_off();
+}
+
+// tlbinval() for a change to pagetable, if it belongs to
+// the current process. Other page tables are either being
+// built, being freed, or are handled by the caller.
+static void
+uvminval(pagetable_t pagetable, uint64 va, uint64 npages)
+{
+  struct proc *p = myproc();
+
+  if(p && p->pagetable == pagetable)
+    tlbinval(p, va, npages);
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
-// create any required page-table pages.
+// create any required page-table pages. If va is in a
+// 2MB megapage, return the megapage's level-1 leaf PTE,
+// which has PTE_MEGA set.
 //
 // The risc-v Sv39 scheme has three levels of page-table
 // pages. A page-table page contains 512 64-bit PTEs.
@@ -86,20 +337,58 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
   for(int level = 2; level > 0; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
+      if(*pte & PTE_MEGA)
+        return pte;
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
   return &pagetable[PX(0, va)];
 }
 
+// Return the address of the level-1 PTE for va, which
+// maps the 2MB megapage containing va if it is a leaf.
+// If alloc!=0, create the level-1 page-table page if
+// needed.
+static pte_t *
+walkmega(pagetable_t pagetable, uint64 va, int alloc)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    panic("walkmega");
+
+  pte = &pagetable[PX(2, va)];
+  if(*pte & PTE_V) {
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  } else {
+    if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
+      return 0;
+    *pte = PA2PTE(pagetable) | PTE_V;
+  }
+  return &pagetable[PX(1, va)];
+}
+
+// Physical address of the page at va, given the leaf
+// PTE that maps it, which may be a megapage's.
+static uint64
+leafpa(pte_t pte, uint64 va)
+{
+  uint64 pa = PTE2PA(pte);
+
+  if(pte & PTE_MEGA)
+    pa += PGROUNDDOWN(va % MEGAPGSIZE);
+  return pa;
+}
+
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
+// Does not fault in lazily-allocated pages; copyin() and
+// friends use uvmaddr() for that.
 uint64
 walkaddr(pagetable_t pagetable, uint64 va)
 {
@@ -116,7 +405,7 @@ walkaddr(pagetable_t pagetable, uint64 va)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
+  pa = leafpa(*pte, va);
   return pa;
 }
 
@@ -132,7 +421,10 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
+// be page-aligned. Wherever the range covers a whole 2MB
+// stretch at which both va and pa are 2MB-aligned, and no
+// page of that stretch is mapped yet, a single megapage PTE
+// maps it. Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
@@ -146,6 +438,16 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
+    if(a % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 &&
+       last - a >= MEGAPGSIZE - PGSIZE &&
+       (pte = walkmega(pagetable, a, 1)) != 0 && (*pte & PTE_V) == 0){
+      *pte = PA2PTE(pa) | perm | PTE_MEGA | PTE_V;
+      if(last - a == MEGAPGSIZE - PGSIZE)
+        break;
+      a += MEGAPGSIZE;
+      pa += MEGAPGSIZE;
+      continue;
+    }
     if((pte = walk(pagetable, a, 1)) == 0)
       return -1;
     if(*pte & PTE_V)
@@ -159,31 +461,113 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   return 0;
 }
 
+// Pages being unmapped by unmapwalk(), to be freed
+// together by kfree_batch(), and the range of addresses
+// whose mappings it actually removed, to flush from the TLB.
+#define UNMAPBATCH 32
+struct unmap {
+  uint64 limit;    // panic on leaves at or above limit
+  int do_free;     // free the pages mapped?
+  int freetables;  // free the page-table pages as well?
+  uint64 lo, hi;   // mappings removed were in [lo, hi)
+  int n;
+  void *pa[UNMAPBATCH];
+};
+
+static void
+unmapfree(struct unmap *u, uint64 pa)
+{
+  if(u->n == UNMAPBATCH){
+    kfree_batch(u->pa, u->n);
+    u->n = 0;
+  }
+  u->pa[u->n++] = (void*)pa;
+}
+
+// Remove the mappings for [va, end) from pt, a page-table
+// page at level; the range must lie within the span that pt
+// maps. Entries with nothing under them are skipped whole,
+// so the cost is in the pages mapped rather than the size
+// of the range.
+static void
+unmapwalk(pagetable_t pt, int level, uint64 va, uint64 end, struct unmap *u)
+{
+  uint64 a, next, i, size = 1L << PXSHIFT(level);
+  pte_t *pte;
+
+  for(a = va; a < end; a = next){
+    next = (a & ~(size - 1)) + size;
+    pte = &pt[PX(level, a)];
+    if(*pte == 0)
+      continue;
+    if((*pte & PTE_V) == 0){
+      if(*pte & PTE_SWAP){
+        if(u->do_free)
+          swapfree(PTE2SLOT(*pte));
+        *pte = 0;
+      }
+      continue;
+    }
+    if(PTE_FLAGS(*pte) == PTE_V){
+      // a lower-level page table.
+      if(level == 0)
+        panic("uvmunmap: not a leaf");
+      unmapwalk((pagetable_t)PTE2PA(*pte), level - 1, a,
+                next < end ? next : end, u);
+      if(u->freetables){
+        unmapfree(u, PTE2PA(*pte));
+        *pte = 0;
+      }
+      continue;
+    }
+
+    if(a >= u->limit)
+      panic("uvmfree: leaf");
+    if(level == 2)
+      panic("uvmunmap: gigapage");
+    if(level == 1){
+      if(a % MEGAPGSIZE != 0 || end - a < MEGAPGSIZE)
+        panic("uvmunmap: part of a megapage");
+      if(u->do_free)
+        for(i = 0; i < MEGAPGSIZE; i += PGSIZE)
+          unmapfree(u, PTE2PA(*pte) + i);
+    } else if(u->do_free){
+      unmapfree(u, PTE2PA(*pte));
+    }
+    *pte = 0;
+    if(a < u->lo)
+      u->lo = a;
+    if(next > u->hi)
+      u->hi = next;
+  }
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never mapped (such as
+// untouched lazily-allocated heap pages) are skipped;
+// swapped-out pages give up their swap slots.
+// A megapage must be removed whole; see uvmdemote().
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
-  pte_t *pte;
+  struct unmap u;
+  uint64 end;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
-    if(PTE_FLAGS(*pte) == PTE_V)
-      panic("uvmunmap: not a leaf");
-    if(do_free){
-      uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
-    }
-    *pte = 0;
-  }
+  end = va + npages*PGSIZE;
+  u.limit = end;
+  u.do_free = do_free;
+  u.freetables = 0;
+  u.lo = end;
+  u.hi = va;
+  u.n = 0;
+  unmapwalk(pagetable, 2, va, end, &u);
+  if(u.lo < u.hi)
+    uvminval(pagetable, u.lo, (u.hi - u.lo) / PGSIZE);
+  kfree_batch(u.pa, u.n);
 }
 
 // create an empty user page table.
@@ -192,10 +576,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -228,12 +611,11 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -261,74 +643,278 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
   return newsz;
 }
 
-// Recursively free page-table pages.
-// All leaf mappings must already have been removed.
-void
-freewalk(pagetable_t pagetable)
-{
-  // there are 2^9 = 512 PTEs in a page table.
-  for(int i = 0; i < 512; i++){
-    pte_t pte = pagetable[i];
-    if((pte & PTE_V) && (pte & (PTE_R|PTE_W|PTE_X)) == 0){
-      // this PTE points to a lower-level page table.
-      uint64 child = PTE2PA(pte);
-      freewalk((pagetable_t)child);
-      pagetable[i] = 0;
-    } else if(pte & PTE_V){
-      panic("freewalk: leaf");
-    }
-  }
-  kfree((void*)pagetable);
-}
-
-// Free user memory pages,
-// then free page-table pages.
+// Free user memory pages below sz, then free page-table
+// pages, in one pass over the page table. Every other
+// mapping must already have been removed.
 void
 uvmfree(pagetable_t pagetable, uint64 sz)
 {
-  if(sz > 0)
-    uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1);
-  freewalk(pagetable);
+  struct unmap u;
+
+  u.limit = PGROUNDUP(sz);
+  u.do_free = 1;
+  u.freetables = 1;
+  u.lo = MAXVA;
+  u.hi = 0;
+  u.n = 0;
+  unmapwalk(pagetable, 2, 0, MAXVA, &u);
+  unmapfree(&u, (uint64)pagetable);
+  kfree_batch(u.pa, u.n);
 }
 
 // Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// its memory in [start, end) into a child's page table.
+// Copies the page table but not the physical
+// memory: both page tables map the same pages,
+// with writable pages turned into read-only
+// copy-on-write pages in both, unless share is set
+// (for a MAP_SHARED area). uvmcow() gives
+// a process its own copy when it writes.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
-uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+uvmcopy(pagetable_t old, pagetable_t new, uint64 start, uint64 end, int share)
 {
-  pte_t *pte;
+  pte_t *pte, *npte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){
+  for(i = start; i < end; i += PGSIZE){
     if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue; // not yet allocated
+    if((*pte & PTE_V) == 0){
+      if(*pte & PTE_SWAP){
+        // share the swap slot.
+        if((npte = walk(new, i, 1)) == 0)
+          goto err;
+        *npte = *pte;
+        swapdup(PTE2SLOT(*pte));
+      }
+      continue;
+    }
+    if((*pte & PTE_W) && !share)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    if(*pte & PTE_MEGA){
+      // share the whole megapage.
+      if((npte = walkmega(new, i, 1)) == 0)
+        goto err;
+      *npte = *pte;
+      for(pa = PTE2PA(*pte); pa < PTE2PA(*pte) + MEGAPGSIZE; pa += PGSIZE)
+        krefinc((void*)pa);
+      i += MEGAPGSIZE - PGSIZE;
+      continue;
+    }
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
-    }
+    krefinc((void*)pa);
   }
+  if(!share)
+    uvminval(old, start, (end - start) / PGSIZE);
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  if(!share)
+    uvminval(old, start, (i - start) / PGSIZE);
+  uvmunmap(new, start, (i - start) / PGSIZE, 1);
   return -1;
 }
 
+// Split the megapage mapping that contains va, if there
+// is one, into 512 4KB mappings of the same pages with the
+// same permissions. Returns 0 on success, -1 if there is
+// no memory for the page-table page.
+int
+uvmdemote(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  pagetable_t pt;
+  uint64 pa;
+  int i;
+
+  if(va >= MAXVA)
+    return 0;
+  if((pte = walkmega(pagetable, va, 0)) == 0 || (*pte & PTE_MEGA) == 0)
+    return 0;
+  if((pt = (pagetable_t)kalloc()) == 0)
+    return -1;
+  pa = PTE2PA(*pte);
+  for(i = 0; i < 512; i++)
+    pt[i] = PA2PTE(pa + i*PGSIZE) | (PTE_FLAGS(*pte) & ~PTE_MEGA);
+  *pte = PA2PTE(pt) | PTE_V;
+  uvminval(pagetable, MEGAPGROUNDDOWN(va), 512);
+  return 0;
+}
+
+// Handle a write to the copy-on-write page at va:
+// give pagetable a private, writable copy of the page,
+// or, if no other page table still shares the page,
+// just make it writable again.
+// Returns 0 on success, -1 if va is not a user COW page
+// or there is no memory for the copy.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  if((pte = walk(pagetable, va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+
+  if(*pte & PTE_MEGA){
+    // keep the megapage if no one else shares any of it;
+    // otherwise copy only the page being written.
+    for(pa = PTE2PA(*pte); pa < PTE2PA(*pte) + MEGAPGSIZE; pa += PGSIZE)
+      if(krefcnt((void*)pa) != 1)
+        break;
+    if(pa == PTE2PA(*pte) + MEGAPGSIZE){
+      *pte = (*pte | PTE_W) & ~PTE_COW;
+      return 0;
+    }
+    if(uvmdemote(pagetable, va) < 0)
+      return -1;
+    pte = walk(pagetable, va, 0);
+  }
+
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+  if(krefcnt((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+    return 0;
+  }
+
+  if(pa == (uint64)zeropage){
+    // the first write to a page of zeroes.
+    if((mem = swapkalloc(1)) == 0)
+      return -1;
+  } else {
+    if((mem = swapkalloc(0)) == 0)
+      return -1;
+    memmove(mem, (char*)pa, PGSIZE);
+  }
+  *pte = PA2PTE(mem) | flags;
+  uvminval(pagetable, va, 1);
+  kfree((void*)pa);
+  return 0;
+}
+
+// Handle a page fault at user virtual address va in
+// pagetable, taken by the user program (see usertrap())
+// or by copyin()/copyout() on its behalf; write is 1 for
+// a store. Reads in the page if va is in one of the
+// current process's file-backed areas or was swapped out,
+// maps a zeroed page if va is in its stack region or heap
+// but was never touched (exec() leaves most of the stack
+// region unmapped, and sbrk() only moves p->sz), or copies a
+// copy-on-write page on a store.
+// Returns 0 if the access can now proceed, -1 if it is
+// illegal or memory is exhausted.
+int
+uvmfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  pte_t *pte;
+  uint64 a;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    if(write && (*pte & PTE_COW))
+      return uvmcow(pagetable, va);
+    return -1;
+  }
+  if(pte && (*pte & PTE_SWAP))
+    return swapin(pagetable, va, pte);
+
+  // not mapped: is it part of the program's image or an
+  // mmap() area, still to be read in from the file (see
+  // exec() and vma.c), or of the lazily-allocated heap?
+  if(p == 0 || p->pagetable != pagetable)
+    return -1;
+  if((v = vmalookup(p->vma, va)) != 0)
+    return vmafill(pagetable, v, va, write);
+  if(va >= p->sz)
+    return -1;
+  if(!write)
+    return uvmzero(pagetable, va, PTE_W|PTE_X|PTE_R|PTE_U);
+
+  // map a megapage if the whole 2MB around va is
+  // untouched heap, falling back to a 4KB page if
+  // there is no 2MB of contiguous memory. the stack
+  // grows a page at a time.
+  a = MEGAPGROUNDDOWN(va);
+  if(a >= p->ustack && a + MEGAPGSIZE <= p->sz && vmaoverlap(p->vma, a, a + MEGAPGSIZE) == 0 &&
+     (pte = walkmega(pagetable, a, 0)) != 0 && *pte == 0 &&
+     (mem = kalloc_pages(MEGAORDER)) != 0){
+    memset(mem, 0, MEGAPGSIZE);
+    if(mappages(pagetable, a, MEGAPGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) == 0)
+      return 0;
+    for(a = 0; a < MEGAPGSIZE; a += PGSIZE)
+      kfree(mem + a);
+  }
+  if((mem = swapkalloc(1)) == 0)
+    return -1;
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Map the shared zero page at va in pagetable, with the
+// permissions perm, except that it is copy-on-write rather
+// than writable. Returns 0 on success, -1 if there is no
+// memory for a page-table page.
+int
+uvmzero(pagetable_t pagetable, uint64 va, int perm)
+{
+  if(perm & PTE_W)
+    perm = (perm & ~PTE_W) | PTE_COW;
+  if(mappages(pagetable, va, PGSIZE, (uint64)zeropage, perm) != 0)
+    return -1;
+  krefinc(zeropage);
+  return 0;
+}
+
+// Return the physical address that a user access to va
+// would reach (write is 1 for a store), after resolving
+// any page fault the access would take, just as if the
+// user program had made it. Returns 0 if the access is
+// illegal.
+static uint64
+uvmaddr(pagetable_t pagetable, uint64 va, int write)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return 0;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (write && (*pte & PTE_W) == 0)){
+    if(uvmfault(pagetable, va, write) < 0)
+      return 0;
+    pte = walk(pagetable, va, 0);
+  }
+  if((*pte & PTE_U) == 0 || (write && (*pte & PTE_W) == 0))
+    return 0;
+  return leafpa(*pte, va);
+}
+
 // mark a PTE invalid for user access.
-// used by exec for the user stack guard page.
+// used by exec for the user stack guard page. the page is
+// left execute-only as well, so that copyout()'s accesses
+// through UALIAS, which the PTE_U bit does not restrict,
+// fault on it too.
 void
 uvmclear(pagetable_t pagetable, uint64 va)
 {
@@ -337,7 +923,65 @@ uvmclear(pagetable_t pagetable, uint64 va)
   pte = walk(pagetable, va, 0);
   if(pte == 0)
     panic("uvmclear");
-  *pte &= ~PTE_U;
+  *pte = (*pte & ~(PTE_U|PTE_R|PTE_W)) | PTE_X;
+  uvminval(pagetable, va, 1);
+}
+
+// Can the copy of len bytes at user address va in
+// pagetable go straight through the current process's
+// alias of its user memory?
+static int
+copydirect(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+
+  return p != 0 && p->pagetable == pagetable &&
+    va < TRAPFRAME && len <= TRAPFRAME - va;
+}
+
+// A copyuser() or copyuserstr() in uaccess.S took a page
+// fault at stval, in the current process's alias of its
+// user memory; write is 1 for a store. Make the page
+// accessible, as uvmfault() would for the user program,
+// with interrupts on if intr is set, as they were in the
+// copy. Called by kerneltrap() with interrupts off.
+// Returns 0 if the copy can continue, -1 if the access is
+// illegal.
+int
+copyfault(uint64 stval, int write, int intr)
+{
+  struct proc *p = myproc();
+  uint64 va = stval - UALIAS;
+  pte_t *pte;
+  int r;
+
+  if(p == 0 || stval < UALIAS || va >= TRAPFRAME)
+    return -1;
+  if(kvmsync(p, va)){
+    // the user page table has grown a new root entry.
+    sfence_vma_page(stval, kasid(p));
+    return 0;
+  }
+
+  pte = walk(p->pagetable, va, 0);
+  if(pte && (*pte & (PTE_V|PTE_U)) == (PTE_V|PTE_U) && (*pte & PTE_R) &&
+     (write == 0 || (*pte & PTE_W))){
+    // a stale TLB entry, or hardware that leaves setting
+    // the accessed and dirty bits to software.
+    *pte |= PTE_A | (write ? PTE_D : 0);
+    sfence_vma_page(stval, kasid(p));
+    return 0;
+  }
+
+  if(intr)
+    intr_on();
+  r = uvmfault(p->pagetable, va, write);
+  intr_off();
+  if(r < 0)
+    return -1;
+  kvmsync(p, va);
+  sfence_vma_page(stval, kasid(p));
+  return 0;
 }
 
 // Copy from kernel to user.
@@ -348,9 +992,12 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(copydirect(pagetable, dstva, len))
+    return copyuser((void*)(UALIAS + dstva), src, len);
+
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 1);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -373,9 +1020,12 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(copydirect(pagetable, srcva, len))
+    return copyuser(dst, (void*)(UALIAS + srcva), len);
+
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -400,9 +1050,16 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   uint64 n, va0, pa0;
   int got_null = 0;
 
+  if(copydirect(pagetable, srcva, 1)){
+    // the string must end below the trapframe.
+    if(max > TRAPFRAME - srcva)
+      max = TRAPFRAME - srcva;
+    return copyuserstr(dst, (void*)(UALIAS + srcva), max);
+  }
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -0,0 +1,562 @@
+//
+// File-backed areas of user memory.
+//
+// exec() does not read a program into memory; it records
+// each loadable segment as a struct vma in p->vma, and
+// uvmfault() calls vmafill() to read in each page of the
+// segment the first time the program touches it.
+//
+// mmap() adds areas to the same table, placed top-down
+// below the trapframe, above the heap. A MAP_PRIVATE area
+// works like a program segment. A MAP_SHARED area maps the
+// file's cached pages writable, so that every process
+// mapping the file sees the others' stores, and writes
+// back the pages it dirtied (PTE_D) when it is unmapped.
+// An area with no file (MAP_ANONYMOUS) is zero-filled.
+// A shared-memory segment (see shm.c) is a MAP_SHARED area
+// whose pages are all mapped when it is attached.
+// Since the pages of mmap() areas are not below p->sz,
+// fork() copies them with vmacopy() and munmap(), exec()
+// and exit() unmap them with vmaunmap().
+//
+// A vma holds a reference to its inode (taken with idup()),
+// so the file stays around as long as some process may
+// still need pages from it, even if it is unlinked.
+//
+// Pages read in from a file are kept in a cache keyed by
+// (inode, offset), so that every process running the same
+// program maps the same physical pages: read-only, or
+// copy-on-write if the segment is writable. The cache holds
+// a page reference of its own, dropped when the inode leaves
+// the inode table (the last process mapping it has exited),
+// when the file is written, or when kalloc() runs out of
+// memory and the page is not mapped anywhere.
+//
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "defs.h"
+
+#define NTEXTHASH 61
+
+// A cached page of a file.
+struct textpage {
+  struct inode *ip;
+  uint off;                // file offset of the page
+  uint n;                  // bytes from the file; the rest is zero
+  int shared;              // page of MAP_SHARED mappings
+  char *mem;
+  struct textpage *next;   // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct textpage *hash[NTEXTHASH];
+  struct kmem_cache *cache;
+} text;
+
+void
+vmainit(void)
+{
+  initlock(&text.lock, "text");
+  text.cache = kmem_cache_create("textpage", sizeof(struct textpage));
+}
+
+static struct textpage**
+texthash(struct inode *ip, uint off)
+{
+  return &text.hash[((uint64)ip / sizeof(*ip) + off / PGSIZE) % NTEXTHASH];
+}
+
+// Look for the page at off in ip, holding n bytes of
+// the file, in the cache. If it is there, return it with
+// a new reference for the caller. A page of MAP_SHARED
+// mappings is found whatever n is, since writes keep it
+// up to date. Caller holds ip->lock.
+static char*
+textget(struct inode *ip, uint off, uint n, int shared)
+{
+  struct textpage *t;
+  char *mem = 0;
+
+  acquire(&text.lock);
+  for(t = *texthash(ip, off); t; t = t->next){
+    if(t->ip == ip && t->off == off && t->shared == shared &&
+       (shared || t->n == n)){
+      mem = t->mem;
+      krefinc(mem);
+      break;
+    }
+  }
+  release(&text.lock);
+  return mem;
+}
+
+// Add mem, just read in from ip, to the cache, which takes
+// its own reference to it. Caller holds ip->lock, so no one
+// else can add the same page. Returns 1 if mem is now
+// shared with the cache, 0 if there was no room for it.
+static int
+textput(struct inode *ip, uint off, uint n, int shared, char *mem)
+{
+  struct textpage *t, **h;
+
+  if((t = kmem_cache_alloc(text.cache)) == 0)
+    return 0;
+  t->ip = ip;
+  t->off = off;
+  t->n = n;
+  t->shared = shared;
+  t->mem = mem;
+  krefinc(mem);
+
+  acquire(&text.lock);
+  h = texthash(ip, off);
+  t->next = *h;
+  *h = t;
+  ip->ntext++;
+  release(&text.lock);
+  return 1;
+}
+
+// Drop cached pages for which drop() says yes.
+// Returns the number of pages the cache let go of.
+static int
+textdrop(int (*drop)(struct textpage*, void*), void *arg)
+{
+  struct textpage *t, **pp, *dead;
+  int i, n;
+
+  dead = 0;
+  acquire(&text.lock);
+  for(i = 0; i < NTEXTHASH; i++){
+    for(pp = &text.hash[i]; (t = *pp) != 0; ){
+      if(drop(t, arg)){
+        *pp = t->next;
+        t->ip->ntext--;
+        t->next = dead;
+        dead = t;
+      } else {
+        pp = &t->next;
+      }
+    }
+  }
+  release(&text.lock);
+
+  for(n = 0; dead; n++){
+    t = dead;
+    dead = t->next;
+    kfree(t->mem);
+    kmem_cache_free(text.cache, t);
+  }
+  return n;
+}
+
+static int
+ofinode(struct textpage *t, void *ip)
+{
+  return t->ip == ip;
+}
+
+static int
+privateof(struct textpage *t, void *ip)
+{
+  return t->ip == ip && !t->shared;
+}
+
+static int
+unmapped(struct textpage *t, void *arg)
+{
+  return krefcnt(t->mem) == 1;
+}
+
+// Forget ip's cached pages, because its content has
+// changed or it is leaving the inode table.
+void
+textfree(struct inode *ip)
+{
+  if(ip->ntext > 0)
+    textdrop(ofinode, ip);
+}
+
+// Bring ip's cached pages up to date with a write of n
+// bytes at off. Private pages are dropped, so that the
+// processes already running the file keep the old content
+// and later ones read the new. The pages of MAP_SHARED
+// mappings stay, with the written bytes read back into
+// them, so that everyone mapping the file keeps sharing
+// them. Caller holds ip->lock.
+void
+textwrite(struct inode *ip, uint off, uint n)
+{
+  struct textpage *t;
+  uint a, lo, hi;
+  char *mem;
+
+  if(ip->ntext == 0)
+    return;
+  textdrop(privateof, ip);
+
+  for(a = PGROUNDDOWN(off); a < off + n; a += PGSIZE){
+    lo = a > off ? a : off;
+    hi = a + PGSIZE < off + n ? a + PGSIZE : off + n;
+    mem = 0;
+    acquire(&text.lock);
+    for(t = *texthash(ip, a); t; t = t->next){
+      if(t->ip == ip && t->off == a && t->shared){
+        mem = t->mem;
+        krefinc(mem);
+        if(t->n < hi - a)
+          t->n = hi - a;
+        break;
+      }
+    }
+    release(&text.lock);
+    if(mem == 0)
+      continue;
+    // the page may be the source of the write, when
+    // vmasync() writes it back; then this changes nothing.
+    readi(ip, 0, (uint64)mem + (lo - a), lo, hi - lo);
+    kfree(mem);
+  }
+}
+
+// Free cached pages that no process has mapped.
+// Called by kalloc() when it runs out of memory.
+// Returns the number of pages freed.
+int
+textreap(void)
+{
+  return textdrop(unmapped, 0);
+}
+
+// Return a free slot in the vma table tab,
+// or 0 if there is none.
+struct vma*
+vmaalloc(struct vma *tab)
+{
+  struct vma *v;
+
+  for(v = tab; v < &tab[NVMA]; v++)
+    if(v->end == 0)
+      return v;
+  return 0;
+}
+
+// Return the area in tab that contains va, or 0.
+struct vma*
+vmalookup(struct vma *tab, uint64 va)
+{
+  struct vma *v;
+
+  for(v = tab; v < &tab[NVMA]; v++)
+    if(v->end != 0 && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Does any area in tab overlap [start, end)?
+int
+vmaoverlap(struct vma *tab, uint64 start, uint64 end)
+{
+  struct vma *v;
+
+  for(v = tab; v < &tab[NVMA]; v++)
+    if(v->end != 0 && v->start < end && v->end > start)
+      return 1;
+  return 0;
+}
+
+// Copy the vma table src to dst, for fork().
+void
+vmadup(struct vma *dst, struct vma *src)
+{
+  int i;
+
+  for(i = 0; i < NVMA; i++){
+    dst[i] = src[i];
+    if(dst[i].end == 0)
+      continue;
+    if(dst[i].ip)
+      idup(dst[i].ip);
+    if(dst[i].shm)
+      shmdup(dst[i].shm);
+  }
+}
+
+// Release an area's inode or segment and free its slot.
+// Must not be called inside a transaction.
+static void
+vmafree(struct vma *v)
+{
+  struct inode *ip = v->ip;
+  struct shm *shm = v->shm;
+
+  memset(v, 0, sizeof(*v));
+  if(shm)
+    shmput(shm);
+  if(ip == 0)
+    return;
+  begin_op();
+  iput(ip);
+  end_op();
+}
+
+// Release every area in tab, for exit() and exec(),
+// unmapping the mmap() areas from pagetable (if it is
+// not 0) first.
+void
+vmaclear(pagetable_t pagetable, struct vma *tab)
+{
+  struct vma *v;
+
+  for(v = tab; v < &tab[NVMA]; v++){
+    if(v->end == 0)
+      continue;
+    if(pagetable && v->flags)
+      vmaunmap(pagetable, tab, v->start, v->end);
+    else
+      vmafree(v);
+  }
+}
+
+// User memory is shrinking to sz bytes: forget
+// the parts of areas that lie above it, so that
+// if it grows again the new pages are zero.
+void
+vmatrim(struct vma *tab, uint64 sz)
+{
+  struct vma *v;
+
+  sz = PGROUNDUP(sz);
+  for(v = tab; v < &tab[NVMA]; v++){
+    if(v->end == 0 || v->flags || v->end <= sz)
+      continue;
+    if(v->start >= sz)
+      vmafree(v);
+    else
+      v->end = sz;
+  }
+}
+
+// Fill in the page at va, which is in area v but not yet
+// mapped in pagetable, from v's file, sharing the cached
+// copy of the page if there is one; write is 1 if the
+// fault is for a store. A read of a private page that is
+// all zero maps the shared zero page.
+// Returns 0 on success, -1 if the area may not be accessed,
+// the page cannot be read or there is no memory for it.
+int
+vmafill(pagetable_t pagetable, struct vma *v, uint64 va, int write)
+{
+  struct inode *ip = v->ip;
+  uint64 off;
+  uint n;
+  int locked, perm, shared;
+  char *mem;
+
+  if((v->perm & (PTE_R|PTE_W|PTE_X)) == 0 || v->shm)
+    return -1; // PROT_NONE; segment pages are mapped on attach
+
+  off = va - v->start;
+  n = 0;
+  if(ip && off < v->filesz)
+    n = v->filesz - off < PGSIZE ? v->filesz - off : PGSIZE;
+
+  shared = 0;
+  if(n == 0){
+    // all zero: nothing to read or share.
+    if(!write && v->flags != MAP_SHARED)
+      return uvmzero(pagetable, va, v->perm | PTE_U);
+    if((mem = swapkalloc(1)) == 0)
+      return -1;
+  } else {
+    // reading the file may sleep, which would deadlock if
+    // this fault is from a copyout() done under a spinlock.
+    if(!cansleep())
+      return -1;
+
+    // the fault may come from a readi() or writei() that
+    // already holds ip's lock, copying to or from a page
+    // of the same file.
+    locked = holdingsleep(&ip->lock);
+    if(!locked)
+      ilock(ip);
+    // an mmap() area may reach past the end of the file.
+    if(v->off + off >= ip->size)
+      n = 0;
+    else if(v->off + off + n > ip->size)
+      n = ip->size - (v->off + off);
+    if((mem = textget(ip, v->off + off, n, v->flags == MAP_SHARED)) != 0){
+      shared = 1;
+    } else if((mem = swapkalloc(0)) != 0){
+      if(readi(ip, 0, (uint64)mem, v->off + off, n) == n){
+        memset(mem + n, 0, PGSIZE - n);
+        shared = textput(ip, v->off + off, n, v->flags == MAP_SHARED, mem);
+      } else {
+        kfree(mem);
+        mem = 0;
+      }
+    }
+    if(!locked)
+      iunlock(ip);
+    if(mem == 0)
+      return -1;
+  }
+
+  // the cache's copy must never be written,
+  // except through a shared mapping of the file.
+  perm = v->perm | PTE_U;
+  if(shared && (perm & PTE_W) && v->flags != MAP_SHARED)
+    perm = (perm & ~PTE_W) | PTE_COW;
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Find a place for an mmap() area of len bytes in tab,
+// as high as possible below the trapframe but not below
+// floor. Returns its start, or 0 if there is no room.
+uint64
+vmaplace(struct vma *tab, uint64 len, uint64 floor)
+{
+  struct vma *v;
+  uint64 end;
+  int moved;
+
+  end = TRAPFRAME;
+  do {
+    if(end < floor + len)
+      return 0;
+    moved = 0;
+    for(v = tab; v < &tab[NVMA]; v++){
+      if(v->end != 0 && v->start < end && v->end > end - len){
+        end = v->start;
+        moved = 1;
+      }
+    }
+  } while(moved);
+  return end - len;
+}
+
+// Give the new page table the pages of the mmap() areas
+// in tab that are mapped in old, for fork(): shared pages
+// with the same permissions, private ones copy-on-write.
+// Returns 0 on success, -1 if there is no memory, in
+// which case new is left without any of them.
+int
+vmacopy(pagetable_t old, pagetable_t new, struct vma *tab)
+{
+  struct vma *v;
+
+  for(v = tab; v < &tab[NVMA]; v++){
+    if(v->end == 0 || v->flags == 0)
+      continue;
+    if(uvmcopy(old, new, v->start, v->end, v->flags == MAP_SHARED) < 0)
+      goto err;
+  }
+  return 0;
+
+ err:
+  while(--v >= tab)
+    if(v->end != 0 && v->flags != 0)
+      uvmunmap(new, v->start, (v->end - v->start) / PGSIZE, 1);
+  return -1;
+}
+
+// Write the page mem, mapped at va in shared area v,
+// back to v's file, or as much of it as the file holds.
+static void
+vmasync(struct vma *v, uint64 va, char *mem)
+{
+  struct inode *ip = v->ip;
+  uint off = v->off + (va - v->start);
+  // at most as many bytes per transaction as filewrite().
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  int i, n, r;
+
+  for(i = 0; i < PGSIZE; i += r){
+    n = PGSIZE - i;
+    if(n > max)
+      n = max;
+    begin_op();
+    ilock(ip);
+    r = 0;
+    if(off + i < ip->size){
+      if(off + i + n > ip->size)
+        n = ip->size - (off + i);
+      r = writei(ip, 0, (uint64)mem + i, off + i, n);
+    }
+    iunlock(ip);
+    end_op();
+    if(r <= 0)
+      break;
+  }
+}
+
+// Unmap [start, end) from the mmap() areas in tab, writing
+// back the dirty pages of shared file mappings, and shrink,
+// split or free the areas. start and end must be
+// page-aligned. Returns 0 on success, -1 if an area would
+// have to be split and the table is full.
+int
+vmaunmap(pagetable_t pagetable, struct vma *tab, uint64 start, uint64 end)
+{
+  struct vma *v, *nv;
+  uint64 a, lo, hi;
+  pte_t *pte;
+
+  for(v = tab; v < &tab[NVMA]; v++){
+    if(v->end == 0 || v->flags == 0 || v->start >= end || v->end <= start)
+      continue;
+    lo = v->start > start ? v->start : start;
+    hi = v->end < end ? v->end : end;
+
+    nv = 0;
+    if(lo > v->start && hi < v->end){
+      // punching a hole: the part above it needs a slot.
+      if((nv = vmaalloc(tab)) == 0)
+        return -1;
+      *nv = *v;
+      if(nv->ip)
+        idup(nv->ip);
+      if(nv->shm)
+        shmdup(nv->shm);
+      nv->start = hi;
+      nv->off += hi - v->start;
+      nv->filesz = nv->filesz > hi - v->start ? nv->filesz - (hi - v->start) : 0;
+    }
+
+    if(v->flags == MAP_SHARED && v->ip && (v->perm & PTE_W)){
+      for(a = lo; a < hi; a += PGSIZE){
+        pte = walk(pagetable, a, 0);
+        if(pte && (*pte & (PTE_V|PTE_D)) == (PTE_V|PTE_D))
+          vmasync(v, a, (char*)PTE2PA(*pte));
+      }
+    }
+    uvmunmap(pagetable, lo, (hi - lo) / PGSIZE, 1);
+
+    if(lo == v->start && hi == v->end){
+      vmafree(v);
+    } else if(lo == v->start){
+      v->off += hi - v->start;
+      v->filesz = v->filesz > hi - v->start ? v->filesz - (hi - v->start) : 0;
+      v->start = hi;
+    } else {
+      v->end = lo;
+      if(v->filesz > lo - v->start)
+        v->filesz = lo - v->start;
+    }
+  }
+  return 0;
+}
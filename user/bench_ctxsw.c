@@ -0,0 +1,52 @@
+//
+// time a ping-pong of one byte between two processes over
+// a pair of pipes: every round trip is two switches between
+// user address spaces. Run it alone, so that the two
+// processes share a CPU and each switch goes through the
+// scheduler, or with other load to see them move between
+// CPUs.
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define N 20000  // round trips
+
+int
+main(int argc, char *argv[])
+{
+  int ping[2], pong[2], i, start, ticks;
+  char c = 'p';
+
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    printf("bench_ctxsw: pipe failed\n");
+    exit(1);
+  }
+
+  if(fork() == 0){
+    close(ping[1]);
+    close(pong[0]);
+    while(read(ping[0], &c, 1) == 1)
+      write(pong[1], &c, 1);
+    exit(0);
+  }
+  close(ping[0]);
+  close(pong[1]);
+
+  start = uptime();
+  for(i = 0; i < N; i++){
+    if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1){
+      printf("bench_ctxsw: ping-pong failed\n");
+      exit(1);
+    }
+  }
+  ticks = uptime() - start;
+  close(ping[1]);
+  wait(0);
+
+  printf("bench_ctxsw: %d round trips in %d ticks", N, ticks);
+  if(ticks > 0)
+    printf(", %d per tick", N / ticks);
+  printf("\n");
+  exit(0);
+}
@@ -0,0 +1,98 @@
+//
+// time process teardown under a grind-style load: several
+// workers at once fork children that grow their memory in
+// different ways (a dense heap, a sparse heap of a few
+// megapages, an mmap() area near the top of memory) and exit, while the
+// workers wait for them. The same loop with children that
+// exit at once gives the cost without teardown.
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NWORKER 4
+#define ROUNDS  40                  // children per worker
+#define DENSE   (2 * 1024 * 1024)   // touched page by page
+#define SPARSE  (16 * 1024 * 1024)  // touched every 4MB
+#define MAPPED  (256 * 1024)        // anonymous mmap() area
+
+static void
+child(int i)
+{
+  char *a, *m;
+  uint64 off;
+
+  if(i < 0)
+    exit(0);
+  a = sbrk(0);
+  switch(i % 3){
+  case 0:
+    if(sbrk(DENSE) == (char*)-1)
+      exit(1);
+    for(off = 0; off < DENSE; off += PGSIZE)
+      a[off] = 1;
+    break;
+  case 1:
+    if(sbrk(SPARSE) == (char*)-1)
+      exit(1);
+    for(off = 0; off < SPARSE; off += 4*1024*1024)
+      a[off] = 1;
+    break;
+  case 2:
+    m = mmap(0, MAPPED, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(m == (char*)-1)
+      exit(1);
+    for(off = 0; off < MAPPED; off += PGSIZE)
+      m[off] = 1;
+    break;
+  }
+  exit(0);
+}
+
+// run NWORKER workers, each forking ROUNDS children; if
+// grow is 0 the children exit at once. Returns ticks.
+static int
+run(int grow)
+{
+  int w, i, start, xstatus, bad;
+
+  start = uptime();
+  for(w = 0; w < NWORKER; w++){
+    if(fork() == 0){
+      bad = 0;
+      for(i = 0; i < ROUNDS; i++){
+        if(fork() == 0)
+          child(grow ? w + i : -1);
+        wait(&xstatus);
+        if(xstatus != 0)
+          bad = 1;
+      }
+      exit(bad);
+    }
+  }
+  bad = 0;
+  for(w = 0; w < NWORKER; w++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      bad = 1;
+  }
+  if(bad){
+    printf("bench_exit: a child failed\n");
+    exit(1);
+  }
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int base, full;
+
+  base = run(0);
+  full = run(1);
+  printf("bench_exit: %d children: %d ticks, %d ticks exiting at once\n",
+    NWORKER * ROUNDS, full, base);
+  exit(0);
+}
@@ -0,0 +1,91 @@
+//
+// time how long a short command takes to run (fork, exec
+// of echo, wait) on an idle machine, with CPU-bound jobs
+// running, and with the same jobs after nice(19). Reports
+// the total and worst response time in ticks.
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NJOBS  8    // CPU-bound jobs
+#define ROUNDS 20   // commands timed each way
+
+char *args[] = { "echo", "-", 0 };
+
+// keep the loop from being optimized away.
+volatile uint64 sink;
+
+static void
+hog(int niceness)
+{
+  uint64 x = 0;
+
+  nice(niceness);
+  for(;;)
+    sink = x++;
+}
+
+static void
+measure(char *what)
+{
+  int i, pid, start, t, total, worst;
+
+  total = worst = 0;
+  for(i = 0; i < ROUNDS; i++){
+    start = uptime();
+    if((pid = fork()) < 0){
+      printf("bench_resp: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      // keep the console quiet.
+      close(1);
+      open("bench_resp.out", O_CREATE|O_WRONLY);
+      exec(args[0], args);
+      exit(1);
+    }
+    wait(0);
+    t = uptime() - start;
+    total += t;
+    if(t > worst)
+      worst = t;
+    // let the jobs run between commands, as a user would.
+    sleep(1);
+  }
+  printf("bench_resp: %s: %d commands in %d ticks, worst %d\n",
+    what, ROUNDS, total, worst);
+}
+
+static void
+run(char *what, int niceness)
+{
+  int i, pids[NJOBS];
+
+  for(i = 0; i < NJOBS; i++){
+    if((pids[i] = fork()) < 0){
+      printf("bench_resp: fork failed\n");
+      exit(1);
+    }
+    if(pids[i] == 0)
+      hog(niceness);
+  }
+  // let the jobs use up their time at the top levels.
+  sleep(10);
+  measure(what);
+  for(i = 0; i < NJOBS; i++){
+    kill(pids[i]);
+    wait(0);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  measure("idle");
+  run("with CPU-bound jobs", 0);
+  run("with niced CPU-bound jobs", 19);
+  unlink("bench_resp.out");
+  exit(0);
+}
@@ -0,0 +1,79 @@
+//
+// time large read()s and write()s, which spend much of
+// their time in copyout() and copyin(): write a 16KB file,
+// read it back many times from the buffer cache, and move
+// bytes through a pipe between two processes. Reports
+// kilobytes per tick.
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define FSZ    (16*1024)  // file size; fits in the buffer cache
+#define NREAD  2000       // times the file is read
+#define NWRITE 50         // times the file is rewritten
+#define PIPEKB (64*1024)  // kilobytes through the pipe
+
+char buf[FSZ];
+
+static void
+report(char *what, int kb, int ticks)
+{
+  printf("bench_rw: %s %dKB in %d ticks", what, kb, ticks);
+  if(ticks > 0)
+    printf(", %dKB per tick", kb / ticks);
+  printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, i, n, start, fds[2];
+  char *name = "bench_rw.tmp";
+
+  memset(buf, 'x', sizeof(buf));
+
+  start = uptime();
+  for(i = 0; i < NWRITE; i++){
+    if((fd = open(name, O_CREATE|O_TRUNC|O_WRONLY)) < 0 ||
+       write(fd, buf, FSZ) != FSZ){
+      printf("bench_rw: write failed\n");
+      exit(1);
+    }
+    close(fd);
+  }
+  report("write", NWRITE * (FSZ/1024), uptime() - start);
+
+  start = uptime();
+  for(i = 0; i < NREAD; i++){
+    if((fd = open(name, O_RDONLY)) < 0 || read(fd, buf, FSZ) != FSZ){
+      printf("bench_rw: read failed\n");
+      exit(1);
+    }
+    close(fd);
+  }
+  report("read", NREAD * (FSZ/1024), uptime() - start);
+  unlink(name);
+
+  if(pipe(fds) < 0){
+    printf("bench_rw: pipe failed\n");
+    exit(1);
+  }
+  start = uptime();
+  if(fork() == 0){
+    close(fds[0]);
+    for(i = 0; i < PIPEKB / (FSZ/1024); i++)
+      if(write(fds[1], buf, FSZ) != FSZ)
+        exit(1);
+    exit(0);
+  }
+  close(fds[1]);
+  n = 0;
+  while((i = read(fds[0], buf, FSZ)) > 0)
+    n += i;
+  close(fds[0]);
+  wait(0);
+  report("pipe", n / 1024, uptime() - start);
+  exit(0);
+}
@@ -0,0 +1,51 @@
+//
+// time N CPU-bound processes, for N = 1, 2, 4 and 8, each
+// doing the same fixed amount of work. Run it with
+// different numbers of CPUs (make CPUS=n qemu): while N
+// is at most the number of CPUs, the time should stay
+// flat if the scheduler spreads the processes out.
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define WORK 20000000  // loop iterations per process
+
+// keep the loop from being optimized away.
+volatile uint64 sink;
+
+static void
+spin(void)
+{
+  uint64 i, x = 0;
+
+  for(i = 0; i < WORK; i++)
+    x = x * 31 + i;
+  sink = x;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, i, start, ticks;
+
+  for(n = 1; n <= 8; n *= 2){
+    start = uptime();
+    for(i = 0; i < n; i++){
+      int pid = fork();
+      if(pid < 0){
+        printf("bench_sched: fork failed\n");
+        exit(1);
+      }
+      if(pid == 0){
+        spin();
+        exit(0);
+      }
+    }
+    for(i = 0; i < n; i++)
+      wait(0);
+    ticks = uptime() - start;
+    printf("bench_sched: %d processes in %d ticks\n", n, ticks);
+  }
+  exit(0);
+}
@@ -0,0 +1,61 @@
+//
+// time starting a trivial program with fork() and exec()
+// and with spawn(), from a parent with a few MB of touched
+// heap, as a shell or xargs with data might have.
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define HEAP (4 * 1024 * 1024)  // parent heap, touched page by page
+#define N 200                   // programs started each way
+
+char *args[] = { "bench_spawn", "child", 0 };
+
+int
+main(int argc, char *argv[])
+{
+  char *a;
+  uint64 i;
+  int n, start, forkexec, spawned;
+
+  if(argc > 1)
+    exit(0); // the program being started
+
+  a = sbrk(0);
+  for(i = 0; i < HEAP; i += PGSIZE){
+    if(sbrk(PGSIZE) == (char*)-1){
+      printf("bench_spawn: sbrk failed\n");
+      exit(1);
+    }
+    a[i] = 1;
+  }
+
+  start = uptime();
+  for(n = 0; n < N; n++){
+    if(fork() == 0){
+      exec(args[0], args);
+      printf("bench_spawn: exec failed\n");
+      exit(1);
+    }
+    wait(0);
+    a[(n * PGSIZE) % HEAP]++; // a parent store after fork() may copy a page
+  }
+  forkexec = uptime() - start;
+
+  start = uptime();
+  for(n = 0; n < N; n++){
+    if(spawn(args[0], args, 0) < 0){
+      printf("bench_spawn: spawn failed\n");
+      exit(1);
+    }
+    wait(0);
+    a[(n * PGSIZE) % HEAP]++;
+  }
+  spawned = uptime() - start;
+
+  printf("bench_spawn: %d programs, %d KB heap: fork+exec %d ticks, spawn %d ticks\n",
+         N, HEAP / 1024, forkexec, spawned);
+  exit(0);
+}
@@ -0,0 +1,112 @@
+//
+// time ulib's memset(), memmove(), memcmp() and strlen() on
+// buffers of several sizes, against byte-at-a-time loops
+// like the ones they replaced. Each test moves TOTAL bytes;
+// reports kilobytes per tick.
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define MAXSZ (64*1024)
+#define TOTAL (32*1024*1024)
+
+char src[MAXSZ + 8], dst[MAXSZ + 8];
+
+static void
+bytememset(char *d, int c, uint n)
+{
+  while(n-- > 0)
+    *d++ = c;
+}
+
+static void
+bytememmove(char *d, const char *s, uint n)
+{
+  while(n-- > 0)
+    *d++ = *s++;
+}
+
+static int
+bytememcmp(const char *p, const char *q, uint n)
+{
+  while(n-- > 0){
+    if(*p != *q)
+      return *p - *q;
+    p++, q++;
+  }
+  return 0;
+}
+
+static uint
+bytestrlen(const char *s)
+{
+  int n;
+
+  for(n = 0; s[n]; n++)
+    ;
+  return n;
+}
+
+static void
+report(char *what, int sz, int off, int word, int ticks)
+{
+  printf("%s %d%s: %s ", what, sz, off ? " unaligned" : "", word ? "word" : "byte");
+  if(ticks > 0)
+    printf("%dKB per tick\n", TOTAL / 1024 / ticks);
+  else
+    printf("<1 tick\n");
+}
+
+// time one function at one size, word-at-a-time if word
+// is set; off misaligns the destination from the source.
+static int
+run(int fn, int sz, int off, int word)
+{
+  int i, n, start;
+  volatile int r = 0;
+
+  n = TOTAL / sz;
+  start = uptime();
+  for(i = 0; i < n; i++){
+    switch(fn){
+    case 0:
+      if(word) memset(dst + off, i, sz); else bytememset(dst + off, i, sz);
+      break;
+    case 1:
+      if(word) memmove(dst + off, src, sz); else bytememmove(dst + off, src, sz);
+      break;
+    case 2:
+      if(word) r += memcmp(dst + off, src, sz); else r += bytememcmp(dst + off, src, sz);
+      break;
+    case 3:
+      if(word) r += strlen(dst + off); else r += bytestrlen(dst + off);
+      break;
+    }
+  }
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  static char *names[] = { "memset", "memmove", "memcmp", "strlen" };
+  static int sizes[] = { 16, 256, 4096, MAXSZ };
+  int fn, i, off, word;
+
+  memset(src, 'x', sizeof(src));
+  for(fn = 0; fn < 4; fn++){
+    for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++){
+      for(off = 0; off <= 1; off++){
+        // memcmp() and strlen() need equal bytes and a '\0'.
+        memmove(dst, src, sizeof(dst));
+        dst[off + sizes[i] - 1] = 0;
+        src[sizes[i] - 1] = 0;
+        for(word = 0; word <= 1; word++)
+          report(names[fn], sizes[i], off, word, run(fn, sizes[i], off, word));
+        src[sizes[i] - 1] = 'x';
+      }
+    }
+  }
+  exit(0);
+}
@@ -0,0 +1,70 @@
+//
+// time a walk over a large array, touching one word per
+// page, when the array is mapped with 2MB megapages and
+// when it is mapped with 4KB pages.
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NMEGA 8     // size of each array, in megapages
+#define NPASS 1000  // walks over each array
+#define SZ (NMEGA * MEGAPGSIZE)
+
+// Read one word from each page of a[0..SZ-1], NPASS times.
+// Returns the number of clock ticks taken.
+int
+walk(char *a)
+{
+  volatile char *p = a;
+  int pass, start, sum;
+  uint64 i;
+
+  sum = 0;
+  start = uptime();
+  for(pass = 0; pass < NPASS; pass++)
+    for(i = 0; i < SZ; i += PGSIZE)
+      sum += p[i];
+  if(sum != 0){
+    printf("bench_tlb: array not zero\n");
+    exit(1);
+  }
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *a, *brk;
+  uint64 i;
+  int mega, small;
+
+  // megapages: move the break to a 2MB boundary and grow
+  // the heap in one step, so that the kernel finds whole
+  // untouched 2MB regions when the array is first used.
+  brk = sbrk(0);
+  if(sbrk((MEGAPGSIZE - (uint64)brk % MEGAPGSIZE) % MEGAPGSIZE) == (char*)-1 ||
+     (a = sbrk(SZ)) == (char*)-1){
+    printf("bench_tlb: sbrk failed\n");
+    exit(1);
+  }
+  mega = walk(a);
+
+  // 4KB pages: grow the heap one page at a time and touch
+  // each page before the next sbrk(), so that no 2MB region
+  // is ever wholly untouched.
+  a = sbrk(0);
+  for(i = 0; i < SZ; i += PGSIZE){
+    if(sbrk(PGSIZE) == (char*)-1){
+      printf("bench_tlb: sbrk failed\n");
+      exit(1);
+    }
+    a[i] = 0;
+  }
+  small = walk(a);
+
+  printf("bench_tlb: %d MB, %d passes: megapages %d ticks, 4KB pages %d ticks\n",
+         SZ / (1024*1024), NPASS, mega, small);
+  exit(0);
+}
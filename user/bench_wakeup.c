@@ -0,0 +1,72 @@
+//
+// time a ping-pong of one byte between two processes over
+// a pair of pipes, as bench_ctxsw does, while NSLEEP other
+// processes are asleep reading a pipe that nothing writes
+// to. Every round trip is two wakeup() calls, which should
+// not have to look at the sleepers.
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define N 20000     // round trips
+#define NSLEEP 60   // sleepers, about what a 64-slot table held
+
+int
+main(int argc, char *argv[])
+{
+  int hold[2], ping[2], pong[2], i, n, start, ticks;
+  char c = 'p';
+
+  if(pipe(hold) < 0 || pipe(ping) < 0 || pipe(pong) < 0){
+    printf("bench_wakeup: pipe failed\n");
+    exit(1);
+  }
+
+  for(n = 0; n < NSLEEP; n++){
+    int pid = fork();
+    if(pid < 0){
+      printf("bench_wakeup: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(hold[1]);
+      read(hold[0], &c, 1);
+      exit(0);
+    }
+  }
+  close(hold[0]);
+
+  if(fork() == 0){
+    close(ping[1]);
+    close(pong[0]);
+    while(read(ping[0], &c, 1) == 1)
+      write(pong[1], &c, 1);
+    exit(0);
+  }
+  close(ping[0]);
+  close(pong[1]);
+
+  start = uptime();
+  for(i = 0; i < N; i++){
+    if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1){
+      printf("bench_wakeup: ping-pong failed\n");
+      exit(1);
+    }
+  }
+  ticks = uptime() - start;
+  close(ping[1]);
+  wait(0);
+
+  // closing the pipe wakes the sleepers.
+  close(hold[1]);
+  for(i = 0; i < n; i++)
+    wait(0);
+
+  printf("bench_wakeup: %d round trips with %d sleepers in %d ticks",
+         N, n, ticks);
+  if(ticks > 0)
+    printf(", %d per tick", N / ticks);
+  printf("\n");
+  exit(0);
+}
@@ -0,0 +1,158 @@
+//
+// stress the physical page allocator from several CPUs
+// at once and report kmem lock contention.
+//
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NCHILD 2
+#define N 100000
+#define SZ 4096
+
+void test1(void);
+void test2(void);
+char buf[SZ];
+
+int
+main(int argc, char *argv[])
+{
+  test1();
+  test2();
+  exit(0);
+}
+
+// Return the total number of test-and-set spins on the
+// kmem and bcache locks so far; optionally print the report.
+int
+ntas(int print)
+{
+  int n;
+  char *c;
+
+  if(statistics(buf, SZ) <= 0){
+    fprintf(2, "ntas: no stats\n");
+  }
+  c = strchr(buf, '=');
+  if(c == 0)
+    return 0;
+  n = atoi(c+2);
+  if(print)
+    printf("%s", buf);
+  return n;
+}
+
+// Children allocate and free pages in a tight loop,
+// each on its own CPU if there are enough of them.
+void
+test1(void)
+{
+  void *a, *a1;
+  int n, m;
+
+  printf("start test1\n");
+  m = ntas(0);
+  printf("test1 before: tot= %d\n", m);
+  for(int i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("fork failed");
+      exit(1);
+    }
+    if(pid == 0){
+      for(i = 0; i < N; i++){
+        a = sbrk(4096);
+        *(int *)(a+4) = 1;
+        a1 = sbrk(-4096);
+        if(a1 != a + 4096){
+          printf("wrong sbrk\n");
+          exit(1);
+        }
+      }
+      exit(0);
+    }
+  }
+
+  for(int i = 0; i < NCHILD; i++){
+    wait(0);
+  }
+  printf("test1 results:\n");
+  n = ntas(1);
+  printf("test1 after: tot= %d (+%d)\n", n, n-m);
+  if(n-m < 10)
+    printf("test1 OK\n");
+  else
+    printf("test1 FAIL\n");
+}
+
+// Count free pages by having a child sbrk() and touch
+// pages until memory runs out, reporting each page back
+// through a pipe.
+int
+countfree(void)
+{
+  int fds[2];
+  char c;
+  int n = 0;
+
+  if(pipe(fds) < 0){
+    printf("pipe() failed in countfree()\n");
+    exit(1);
+  }
+  int pid = fork();
+  if(pid < 0){
+    printf("fork failed in countfree()\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    while(1){
+      uint64 a = (uint64) sbrk(4096);
+      if(a == 0xffffffffffffffff)
+        break;
+      // modify the memory to make sure it's really allocated.
+      *(char *)(a + 4096 - 1) = 1;
+      if(write(fds[1], "x", 1) != 1)
+        exit(1);
+    }
+    exit(0);
+  }
+  close(fds[1]);
+  while(read(fds[0], &c, 1) == 1)
+    n++;
+  close(fds[0]);
+  wait(0);
+  return n;
+}
+
+// One process must be able to allocate nearly all of
+// memory, stealing pages off the other CPUs' free lists,
+// and repeated rounds must not lose pages.
+void
+test2(void)
+{
+  int free0 = countfree();
+  int n = (PHYSTOP-KERNBASE)/PGSIZE;
+
+  printf("start test2\n");
+  printf("total free number of pages: %d (out of %d)\n", free0, n);
+  if(n - free0 > 1000){
+    printf("test2 FAILED: cannot allocate enough memory\n");
+    exit(1);
+  }
+  for(int i = 0; i < 50; i++){
+    int free1 = countfree();
+    if(i % 10 == 9)
+      printf(".");
+    if(free1 != free0){
+      printf("test2 FAIL: losing pages\n");
+      exit(1);
+    }
+  }
+  printf("\ntest2 OK\n");
+}
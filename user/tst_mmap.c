@@ -0,0 +1,203 @@
+// tst_mmap.c: file-backed and anonymous mmap()
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define PGSIZE 4096
+#define N (2*PGSIZE + 100)
+
+char buf[N];
+
+void
+fail(char *what)
+{
+  printf("tst_mmap: %s failed\n", what);
+  exit(1);
+}
+
+void
+mkfile(char *name)
+{
+  int fd, i;
+
+  for(i = 0; i < N; i++)
+    buf[i] = 'a' + i % 26;
+  unlink(name);
+  if((fd = open(name, O_CREATE|O_RDWR)) < 0)
+    fail("create");
+  if(write(fd, buf, N) != N)
+    fail("write");
+  close(fd);
+}
+
+// read a file through a private mapping; stores must
+// not reach the file. Bytes past the end are zero.
+void
+private(void)
+{
+  int fd, i;
+  char *p;
+
+  mkfile("mmapfile");
+  if((fd = open("mmapfile", O_RDONLY)) < 0)
+    fail("open");
+  p = mmap(0, 3*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1)
+    fail("mmap private");
+  close(fd);
+  for(i = 0; i < N; i++)
+    if(p[i] != 'a' + i % 26)
+      fail("private contents");
+  for(i = N; i < 3*PGSIZE; i++)
+    if(p[i] != 0)
+      fail("private zero tail");
+  p[0] = 'Z';
+  if(munmap(p, 3*PGSIZE) < 0)
+    fail("munmap private");
+
+  if((fd = open("mmapfile", O_RDONLY)) < 0 || read(fd, buf, 1) != 1)
+    fail("reread");
+  if(buf[0] != 'a')
+    fail("private store reached the file");
+  close(fd);
+}
+
+// stores through a shared mapping reach the file when it
+// is unmapped, and a child sees the parent's stores.
+void
+shared(void)
+{
+  int fd, pid, xstatus;
+  char *p;
+
+  mkfile("mmapfile");
+  if((fd = open("mmapfile", O_RDWR)) < 0)
+    fail("open");
+  p = mmap(0, N, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1)
+    fail("mmap shared");
+  close(fd);
+  p[0] = 'X';
+  p[PGSIZE] = 'Y';
+
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    if(p[0] != 'X' || p[PGSIZE] != 'Y')
+      exit(1);
+    p[1] = 'W';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    fail("child view of shared mapping");
+  if(p[1] != 'W')
+    fail("child store to shared mapping");
+
+  // unmap the first page only, then the rest.
+  if(munmap(p, PGSIZE) < 0 || munmap(p + PGSIZE, N - PGSIZE) < 0)
+    fail("munmap shared");
+
+  if((fd = open("mmapfile", O_RDONLY)) < 0 || read(fd, buf, N) != N)
+    fail("reread");
+  close(fd);
+  if(buf[0] != 'X' || buf[1] != 'W' || buf[PGSIZE] != 'Y' || buf[2] != 'c')
+    fail("shared store did not reach the file");
+  unlink("mmapfile");
+}
+
+// processes that map the file one after another share
+// the same pages, even after one of them has unmapped its
+// mapping and written it back; so does write().
+int
+mapchild(char *name, int i, char want, char c)
+{
+  int fd, pid, xstatus;
+  char *p;
+
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    if((fd = open(name, O_RDWR)) < 0)
+      exit(1);
+    p = mmap(0, N, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if(p == (char*)-1)
+      exit(1);
+    close(fd);
+    if(p[i - 1] != want)
+      exit(1);
+    p[i] = c;
+    if(munmap(p, N) < 0)
+      exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  return xstatus;
+}
+
+void
+remap(void)
+{
+  int fd;
+  char *p;
+
+  mkfile("mmapfile");
+  if((fd = open("mmapfile", O_RDWR)) < 0)
+    fail("open");
+  p = mmap(0, N, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1)
+    fail("mmap shared");
+  p[0] = 'X';
+
+  if(mapchild("mmapfile", 1, 'X', 'B') != 0)
+    fail("first child view of shared mapping");
+  if(p[1] != 'B')
+    fail("first child store after munmap");
+  if(mapchild("mmapfile", 2, 'B', 'C') != 0)
+    fail("second child view of shared mapping");
+  if(p[2] != 'C')
+    fail("second child store after munmap");
+
+  if(write(fd, "D", 1) != 1)
+    fail("write");
+  if(p[0] != 'D')
+    fail("write to a shared mapping");
+  close(fd);
+  if(munmap(p, N) < 0)
+    fail("munmap shared");
+  unlink("mmapfile");
+}
+
+// anonymous memory is zero, and the area can be reused.
+void
+anonymous(void)
+{
+  char *p, *q;
+  int i;
+
+  p = mmap(0, 4*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(p == (char*)-1)
+    fail("mmap anonymous");
+  for(i = 0; i < 4*PGSIZE; i++)
+    if(p[i] != 0)
+      fail("anonymous zero");
+  p[PGSIZE] = 1;
+  if(munmap(p, 4*PGSIZE) < 0)
+    fail("munmap anonymous");
+  q = mmap(0, 4*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(q != p || q[PGSIZE] != 0)
+    fail("anonymous reuse");
+  munmap(q, 4*PGSIZE);
+}
+
+int
+main()
+{
+  private();
+  shared();
+  remap();
+  anonymous();
+  printf("tst_mmap: OK\n");
+  exit(0);
+}
@@ -0,0 +1,84 @@
+// tst_procs.c: many more processes than the old 64-slot
+// table held: wait() collects each child exactly once,
+// kill() finds a process by pid among them, and orphans
+// are passed to init.
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define NCHILD 300
+
+int pids[NCHILD];
+
+void
+fail(char *what)
+{
+  printf("tst_procs: %s failed\n", what);
+  exit(1);
+}
+
+int
+main()
+{
+  int hold[2], i, j, n, pid, xstatus;
+  char c;
+
+  // children asleep on a pipe, all alive at once.
+  if(pipe(hold) < 0)
+    fail("pipe");
+  for(i = 0; i < NCHILD; i++){
+    if((pids[i] = fork()) < 0)
+      fail("fork");
+    if(pids[i] == 0){
+      close(hold[1]);
+      read(hold[0], &c, 1);
+      exit(i % 7);
+    }
+  }
+  close(hold[0]);
+
+  // kill every third one; the rest exit when the pipe closes.
+  for(i = 0; i < NCHILD; i += 3)
+    if(kill(pids[i]) < 0)
+      fail("kill");
+  if(kill(123456789) != -1)
+    fail("kill of no such pid");
+  close(hold[1]);
+
+  for(n = 0; n < NCHILD; n++){
+    if((pid = wait(&xstatus)) < 0)
+      fail("wait");
+    for(i = 0; i < NCHILD && pids[i] != pid; i++)
+      ;
+    if(i == NCHILD)
+      fail("wait pid");
+    if(xstatus != (i % 3 == 0 ? -1 : i % 7))
+      fail("exit status");
+    pids[i] = 0;
+  }
+  if(wait(0) != -1)
+    fail("wait with no children");
+
+  // a child that leaves grandchildren behind: they go to
+  // init, and the child's parent sees only the child.
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    for(j = 0; j < 100; j++){
+      if((pid = fork()) < 0)
+        exit(1);
+      if(pid == 0){
+        sleep(2);
+        exit(0);
+      }
+    }
+    exit(0);
+  }
+  if(wait(&xstatus) != pid || xstatus != 0)
+    fail("orphaning child");
+  if(wait(0) != -1)
+    fail("wait after orphaning");
+
+  printf("tst_procs: OK\n");
+  exit(0);
+}
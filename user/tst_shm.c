@@ -0,0 +1,79 @@
+// tst_shm.c: bulk data through a shared-memory segment,
+// with a pipe carrying only the "ready" signals.
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define SZ (64*1024)
+#define ROUNDS 8
+
+void
+fail(char *what)
+{
+  printf("tst_shm: %s failed\n", what);
+  exit(1);
+}
+
+int
+main()
+{
+  int id, i, r, pid, xstatus;
+  int ready[2], done[2];
+  char *p, *q, c;
+
+  if((id = shm_create(SZ)) < 0)
+    fail("shm_create");
+  if((p = shm_attach(id)) == (char*)-1)
+    fail("shm_attach");
+  if(shm_attach(id) != p)
+    fail("second shm_attach");
+  for(i = 0; i < SZ; i++)
+    if(p[i] != 0)
+      fail("zeroed segment");
+
+  if(pipe(ready) < 0 || pipe(done) < 0)
+    fail("pipe");
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    // consumer: drop the inherited attachment and
+    // attach the segment again by id.
+    close(ready[1]);
+    close(done[0]);
+    if(shm_detach(p) < 0)
+      fail("shm_detach");
+    if((q = shm_attach(id)) == (char*)-1)
+      fail("child shm_attach");
+    for(r = 0; r < ROUNDS; r++){
+      if(read(ready[0], &c, 1) != 1)
+        fail("read ready");
+      for(i = 0; i < SZ; i++)
+        if(q[i] != (char)(r + i))
+          fail("consumer data");
+      q[0] = 'k';
+      write(done[1], "d", 1);
+    }
+    exit(0);
+  }
+
+  // producer
+  close(ready[0]);
+  close(done[1]);
+  for(r = 0; r < ROUNDS; r++){
+    for(i = 0; i < SZ; i++)
+      p[i] = r + i;
+    write(ready[1], "r", 1);
+    if(read(done[0], &c, 1) != 1 || p[0] != 'k')
+      fail("producer ack");
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    fail("consumer");
+
+  if(shm_detach(p) < 0)
+    fail("shm_detach");
+  if(shm_attach(id) != (char*)-1)
+    fail("segment freed after last detach");
+  printf("tst_shm: OK\n");
+  exit(0);
+}
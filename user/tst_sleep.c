@@ -0,0 +1,61 @@
+// tst_sleep.c: sleep(n) returns after n ticks, not earlier
+// and not much later, with many processes sleeping at once
+// for different times (some longer than a turn of the timer
+// wheel), and kill() cuts a sleep short.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+#define NCHILD 20
+
+void
+fail(char *what)
+{
+  printf("tst_sleep: %s failed\n", what);
+  exit(1);
+}
+
+int
+main()
+{
+  int i, n, pid, start, xstatus;
+
+  for(i = 0; i < NCHILD; i++){
+    if((pid = fork()) < 0)
+      fail("fork");
+    if(pid == 0){
+      n = 1 + i * (2 * NWHEEL / NCHILD);
+      start = uptime();
+      if(sleep(n) < 0)
+        exit(2);
+      n = uptime() - start - n;
+      exit(n < 0 ? 3 : n > 5 ? 4 : 0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus == 3)
+      fail("sleep too short");
+    if(xstatus == 4)
+      fail("sleep too long");
+    if(xstatus != 0)
+      fail("sleep");
+  }
+
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    sleep(1000000);
+    exit(0);
+  }
+  sleep(2);
+  start = uptime();
+  kill(pid);
+  wait(&xstatus);
+  if(xstatus != -1 || uptime() - start > 5)
+    fail("kill");
+
+  printf("tst_sleep: OK\n");
+  exit(0);
+}
@@ -0,0 +1,68 @@
+// tst_stack.c: the user stack grows on demand, up to
+// USTACKPAGES pages, and overflowing it kills the process.
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define FRAME 2048
+
+void
+fail(char *what)
+{
+  printf("tst_stack: %s failed\n", what);
+  exit(1);
+}
+
+// recurse depth deep with a FRAME-byte array in each
+// frame, and check that every frame kept its contents.
+int
+deep(int depth)
+{
+  volatile char buf[FRAME];
+  int i, r;
+
+  for(i = 0; i < FRAME; i++)
+    buf[i] = depth + i;
+  r = depth > 0 ? deep(depth - 1) : 0;
+  for(i = 0; i < FRAME; i++)
+    if(buf[i] != (char)(depth + i))
+      return -1;
+  return r;
+}
+
+int
+main()
+{
+  int pid, xstatus;
+
+  // about half of the stack region.
+  if(deep(USTACKPAGES*PGSIZE / 2 / FRAME) != 0)
+    fail("deep recursion");
+
+  // a large array on the stack.
+  if(fork() == 0){
+    volatile char big[64*PGSIZE];
+    big[0] = 1;
+    big[sizeof(big) - 1] = 2;
+    exit(big[0] + big[sizeof(big) - 1] == 3 ? 0 : 1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    fail("large stack array");
+
+  // past the limit: the guard page below the region.
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    deep(2 * USTACKPAGES*PGSIZE / FRAME);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1)
+    fail("stack overflow");
+
+  printf("tst_stack: OK\n");
+  exit(0);
+}
@@ -0,0 +1,84 @@
+// tst_zero.c: pages that are read before they are written
+// share the zero page, and get a page of their own on the
+// first write.
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+// more than the machine's memory: reading all of it only
+// works if the pages are shared.
+#define HEAP (256 * 1024 * 1024)
+#define MAPPED (64 * PGSIZE)
+
+char bss[256 * PGSIZE];
+
+void
+fail(char *what)
+{
+  printf("tst_zero: %s failed\n", what);
+  exit(1);
+}
+
+// every page in [a, a+n) reads as zero, except that
+// page i of written[] (if written) holds i+1.
+void
+check(char *a, int n, int written)
+{
+  int i;
+
+  for(i = 0; i < n / PGSIZE; i++){
+    if(a[i*PGSIZE] != (written && i % 8 == 0 ? (char)(i + 1) : 0))
+      fail("page contents");
+    if(a[i*PGSIZE + PGSIZE - 1] != 0)
+      fail("end of page");
+  }
+}
+
+// read all of [a, a+n), then write every eighth page, and
+// check that only those changed, in this process and not
+// in a child that writes too.
+void
+test(char *a, int n)
+{
+  int i, xstatus;
+
+  check(a, n, 0);
+  for(i = 0; i < n / PGSIZE; i += 8)
+    a[i*PGSIZE] = i + 1;
+  check(a, n, 1);
+
+  if(fork() == 0){
+    for(i = 1; i < n / PGSIZE; i += 8)
+      a[i*PGSIZE + PGSIZE - 1] = 7;
+    for(i = 1; i < n / PGSIZE; i += 8)
+      if(a[i*PGSIZE + PGSIZE - 1] != 7 || a[i*PGSIZE] != 0)
+        exit(1);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    fail("child");
+  check(a, n, 1);
+}
+
+int
+main()
+{
+  char *a;
+
+  test(bss, sizeof(bss));
+
+  if((a = mmap(0, MAPPED, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0)) == (char*)-1)
+    fail("mmap");
+  test(a, MAPPED);
+
+  if((a = sbrk(HEAP)) == (char*)-1)
+    fail("sbrk");
+  check(a, HEAP, 0);
+  test(a, 64 * PGSIZE);
+
+  printf("tst_zero: OK\n");
+  exit(0);
+}
@@ -3,6 +3,20 @@
 #include "kernel/fcntl.h"
 #include "user/user.h"
 
+// memset(), memmove(), memcmp() and strlen() work a 64-bit
+// word at a time where the alignment of their arguments
+// allows, and a byte at a time at the ends.
+
+// a word that may alias memory of any other type.
+typedef uint64 __attribute__((may_alias)) word;
+
+#define WSZ ((int)sizeof(word))
+#define ONES  0x0101010101010101UL
+#define HIGHS 0x8080808080808080UL
+
+// Does word w have a zero byte?
+#define HASZERO(w) (((w) - ONES) & ~(w) & HIGHS)
+
 char*
 strcpy(char *s, const char *t)
 {
@@ -22,24 +36,47 @@ strcmp(const char *p, const char *q)
   return (uchar)*p - (uchar)*q;
 }
 
+// Reading whole aligned words may look past the '\0', but
+// never past the end of its page.
 uint
 strlen(const char *s)
 {
-  int n;
+  const char *p = s;
+  const word *w;
 
-  for(n = 0; s[n]; n++)
+  for(; (uint64)p & (WSZ-1); p++)
+    if(*p == 0)
+      return p - s;
+  for(w = (const word *) p; !HASZERO(*w); w++)
     ;
-  return n;
+  for(p = (const char *) w; *p; p++)
+    ;
+  return p - s;
 }
 
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  word *wdst, w;
+
+  while(n > 0 && ((uint64)cdst & (WSZ-1))){
+    *cdst++ = c;
+    n--;
+  }
+  wdst = (word *) cdst;
+  w = (uchar)c * ONES;
+  for(; n >= 4*WSZ; n -= 4*WSZ, wdst += 4){
+    wdst[0] = w;
+    wdst[1] = w;
+    wdst[2] = w;
+    wdst[3] = w;
   }
+  for(; n >= WSZ; n -= WSZ)
+    *wdst++ = w;
+  cdst = (char *) wdst;
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -101,15 +138,46 @@ memmove(void *vdst, const void *vsrc, int n)
 {
   char *dst;
   const char *src;
+  int aligned;
 
   dst = vdst;
   src = vsrc;
+  aligned = (((uint64)src ^ (uint64)dst) & (WSZ-1)) == 0;
   if (src > dst) {
+    if(aligned){
+      for(; n > 0 && ((uint64)dst & (WSZ-1)); n--)
+        *dst++ = *src++;
+      for(; n >= 4*WSZ; n -= 4*WSZ, dst += 4*WSZ, src += 4*WSZ){
+        ((word*)dst)[0] = ((word*)src)[0];
+        ((word*)dst)[1] = ((word*)src)[1];
+        ((word*)dst)[2] = ((word*)src)[2];
+        ((word*)dst)[3] = ((word*)src)[3];
+      }
+      for(; n >= WSZ; n -= WSZ, dst += WSZ, src += WSZ)
+        *(word*)dst = *(word*)src;
+    }
     while(n-- > 0)
       *dst++ = *src++;
   } else {
     dst += n;
     src += n;
+    if(aligned){
+      for(; n > 0 && ((uint64)dst & (WSZ-1)); n--)
+        *--dst = *--src;
+      for(; n >= 4*WSZ; n -= 4*WSZ){
+        dst -= 4*WSZ;
+        src -= 4*WSZ;
+        ((word*)dst)[3] = ((word*)src)[3];
+        ((word*)dst)[2] = ((word*)src)[2];
+        ((word*)dst)[1] = ((word*)src)[1];
+        ((word*)dst)[0] = ((word*)src)[0];
+      }
+      for(; n >= WSZ; n -= WSZ){
+        dst -= WSZ;
+        src -= WSZ;
+        *(word*)dst = *(word*)src;
+      }
+    }
     while(n-- > 0)
       *--dst = *--src;
   }
@@ -120,6 +188,15 @@ int
 memcmp(const void *s1, const void *s2, uint n)
 {
   const char *p1 = s1, *p2 = s2;
+
+  if((((uint64)p1 ^ (uint64)p2) & (WSZ-1)) == 0){
+    while(n > 0 && ((uint64)p1 & (WSZ-1)) && *p1 == *p2)
+      n--, p1++, p2++;
+    // skip equal words; the bytes find the difference.
+    if(((uint64)p1 & (WSZ-1)) == 0)
+      for(; n >= WSZ && *(word*)p1 == *(word*)p2; n -= WSZ)
+        p1 += WSZ, p2 += WSZ;
+  }
   while (n-- > 0) {
     if (*p1 != *p2) {
       return *p1 - *p2;
@@ -11,6 +11,7 @@ int read(int, void*, int);
 int close(int);
 int kill(int);
 int exec(char*, char**);
+int spawn(char*, char**, int*);
 int open(const char*, int);
 int mknod(const char*, short, short);
 int unlink(const char*);
@@ -23,6 +24,12 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+int shm_create(int);
+void* shm_attach(int);
+int shm_detach(void*);
+int nice(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -40,3 +47,6 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+
+// statistics.c
+int statistics(void*, int);
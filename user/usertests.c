@@ -2041,12 +2041,12 @@ iref(char *s)
 }
 
 // test that fork fails gracefully
-// the forktest binary also does this, but it runs out of proc entries first.
+// the forktest binary also does this, but it may run out of proc entries first.
 // inside the bigger usertests binary, we run out of memory first.
 void
 forktest(char *s)
 {
-  enum{ N = 1000 };
+  enum{ N = NPROC };
   int n, pid;
 
   for(n=0; n<N; n++){
@@ -2063,7 +2063,7 @@ forktest(char *s)
   }
 
   if(n == N){
-    printf("%s: fork claimed to work 1000 times!\n", s);
+    printf("%s: fork claimed to work %d times!\n", s, N);
     exit(1);
   }
 
@@ -2304,11 +2304,13 @@ sbrkfail(char *s)
   if(pid == 0){
     // allocate a lot of memory.
     // this should produce a page fault,
-    // and thus not complete.
+    // and thus not complete. the pages must be
+    // written: reads would all share the zero page.
     a = sbrk(0);
     sbrk(10*BIG);
     int n = 0;
     for (i = 0; i < 10*BIG; i += PGSIZE) {
+      *(a+i) = 1;
       n += *(a+i);
     }
     // print n so the compiler doesn't optimize away
@@ -2493,8 +2495,9 @@ stacktest(char *s)
   pid = fork();
   if(pid == 0) {
     char *sp = (char *) r_sp();
-    sp -= PGSIZE;
-    // the *sp should cause a trap.
+    // the stack grows down to USTACKPAGES pages; below
+    // that is the guard page, and *sp should cause a trap.
+    sp -= USTACKPAGES*PGSIZE;
     printf("%s: stacktest: read below stack %p\n", s, *sp);
     exit(1);
   } else if(pid < 0){
@@ -2617,6 +2620,67 @@ sbrk8000(char *s)
   *(top-1) = *(top-1) + 1;
 }
 
+// shrinking the heap, or unmapping part of an mmap() area,
+// across a 2MB boundary (the span of a last-level page
+// table) must leave memory below the range alone.
+// strcmp() is in the program text, and shrinkdata in its data.
+char shrinkdata[] = "shrinkdata";
+
+void
+sbrkshrink(char *s)
+{
+  char *base, *p, *top, *m, *b;
+  uint64 a;
+
+  // a marker page below p, in the same 2MB as p.
+  base = sbrk(0);
+  p = (char*)(MEGAPGROUNDDOWN((uint64)base) + MEGAPGSIZE + MEGAPGSIZE/2);
+  top = p + 2*MEGAPGSIZE;
+  if(sbrk(top - base) == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(a = PGROUNDUP((uint64)base); a < (uint64)top; a += PGSIZE)
+    *(char*)a = 1;
+  p[-PGSIZE] = 'x';
+  if(sbrk(-(top - p)) == (char*)-1){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+  if(p[-PGSIZE] != 'x' || strcmp(shrinkdata, "shrinkdata") != 0){
+    printf("%s: memory below the shrunk heap is damaged\n", s);
+    exit(1);
+  }
+  sbrk(-(p - base));
+
+  // the same for munmap() of a range across a 2MB boundary.
+  m = mmap(0, 2*MEGAPGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(m == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  b = (char*)MEGAPGROUNDDOWN((uint64)m + 3*MEGAPGSIZE/2);
+  for(a = (uint64)m; a < (uint64)m + 2*MEGAPGSIZE; a += PGSIZE)
+    *(char*)a = 'm';
+  if(munmap(b - MEGAPGSIZE/4, MEGAPGSIZE/2) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  for(a = (uint64)m; a < (uint64)m + 2*MEGAPGSIZE; a += PGSIZE){
+    if(a >= (uint64)b - MEGAPGSIZE/4 && a < (uint64)b + MEGAPGSIZE/4)
+      continue;
+    if(*(char*)a != 'm'){
+      printf("%s: memory beside the unmapped range is damaged\n", s);
+      exit(1);
+    }
+  }
+  if(strcmp(shrinkdata, "shrinkdata") != 0){
+    printf("%s: program damaged by munmap\n", s);
+    exit(1);
+  }
+  munmap(m, 2*MEGAPGSIZE);
+}
+
 // regression test. does write() with an invalid buffer pointer cause
 // a block to be allocated for a file that is then not freed when the
 // file is deleted? if the kernel has this bug, it will panic: balloc:
@@ -2860,6 +2924,7 @@ main(int argc, char *argv[])
     {sbrkarg, "sbrkarg"},
     {sbrklast, "sbrklast"},
     {sbrk8000, "sbrk8000"},
+    {sbrkshrink, "sbrkshrink"},
     {validatetest, "validatetest"},
     {stacktest, "stacktest"},
     {opentest, "opentest"},
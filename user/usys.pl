@@ -36,3 +36,10 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("mmap");
+entry("munmap");
+entry("shm_create");
+entry("shm_attach");
+entry("shm_detach");
+entry("spawn");
+entry("nice");
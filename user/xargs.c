@@ -41,7 +41,7 @@ int main(int argc, char *argv[]) {
 
   exargv[exargc] = buf;
 
-  int eof, pid; 
+  int eof; 
   for (; ;) {
     eof = readline(buf);
 
@@ -49,13 +49,8 @@ int main(int argc, char *argv[]) {
 	
 	if (eof) exit(0);
 
-	pid = fork();
-
-    // Child process
-	if (pid == 0) {
-	  exec(argv[1], exargv);
+	// start the command without copying xargs itself.
+	if (spawn(argv[1], exargv, 0) < 0)
 	  fprintf(2, "xargs: exec failed.\n");
-	  exit(1);
-	}
   }
 }